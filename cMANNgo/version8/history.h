@@ -0,0 +1,116 @@
+// Binary history files (history_%d.bin), written by social and read by historyconv.
+//
+// A file is a HistoryFileHeader, the text of parameters_%d.txt (parametersSize bytes), and
+// then fixed width records, one per row of the text history, from offset headerSize:
+//
+//   int32_t tick        0 for the rows written after pretraining
+//   int32_t agent       original agent number
+//   int32_t sender      sending agent, or one of the HISTORY_SENDER_ codes below
+//   value   inputs[nFeatures]    only meaningful when sender != HISTORY_SENDER_NONE
+//   value   outputs[nFeatures]
+//
+// where value is a float or a double (valueSize, the size of Lens's real) stored exactly, or
+// with valueEncoding HISTORY_VALUES_FIXED an unsigned 8 or 16 bit integer (valueSize 1 or 2)
+// equal to round(x * valueScale) for a value x in [0, 1], valueScale being 255 or 65535.
+// Decoded fixed point values are off by at most 0.5 / valueScale (0.00196 for 8 bits,
+// 0.0000076 for 16 bits); 0 and 1, which is what binary prototype inputs are, are exact.
+// The record layout is given by the offsets in the header so that columns can be added
+// later without breaking readers.  All fields are in the byte order of the machine that
+// wrote the file; byteOrder tells readers whether it is theirs.
+//
+// With codec HISTORY_CODEC_ZLIB the records are instead stored in compressed blocks of at
+// most blockRecords records, each a HistoryBlockHeader followed by compressedSize bytes.
+// The records of a block are first split into columns:
+//
+//   tick, agent   int32_t[n], each the difference from the previous record of the block
+//   sender        int32_t[n]
+//   input mode    uint8_t[n]: HISTORY_INPUTS_NONE, _BITS (every input is 0 or 1) or _VALUES
+//   input bits    one bit per input (first input in the lowest bit) for the _BITS records
+//   input values  value[nFeatures] for the _VALUES records
+//   outputs       value[n * nFeatures], XORed bit for bit with the outputs of the previous
+//                 record of the same agent in the block, if any
+//
+// the int32_t columns and the value columns are byte-shuffled (all first bytes, then all
+// second bytes, ...), and the result (rawSize bytes) is compressed with zlib.  Blocks can
+// be decoded independently.  After the last block comes an index with a HistoryIndexEntry
+// for every block and then a HistoryIndexTrailer, which ends the file.
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_MAGIC      "CMHIST01"
+#define HISTORY_VERSION    3
+#define HISTORY_BYTE_ORDER 0x01020304
+
+#define HISTORY_VALUES_REAL  0
+#define HISTORY_VALUES_FIXED 1
+
+#define HISTORY_CODEC_NONE 0
+#define HISTORY_CODEC_ZLIB 1
+
+#define HISTORY_INPUTS_NONE   0
+#define HISTORY_INPUTS_BITS   1
+#define HISTORY_INPUTS_VALUES 2
+
+#define HISTORY_INDEX_MAGIC "CMHINDEX"
+
+#define HISTORY_SENDER_NONE        (-1) // not the receiving agent this tick ("0 -" in text)
+#define HISTORY_SENDER_PROTOTYPE   (-2) // input was a distortion of the prototype ("1 P")
+#define HISTORY_SENDER_PRETRAINING (-3) // row written after pretraining ("- -"), at tick 0 or when
+                                        // social created the agent (LAZY_AGENTS)
+
+typedef struct HistoryFileHeader
+{
+    char     magic[8];       // HISTORY_MAGIC
+    uint32_t version;
+    uint32_t byteOrder;      // HISTORY_BYTE_ORDER
+    uint32_t headerSize;     // offset of the first record
+    uint32_t parametersSize; // bytes of parameter text after this header
+    int32_t  runNum;
+    int32_t  nAgents;
+    int32_t  nTicks;
+    int32_t  nFeatures;
+    uint32_t omitRows;       // OMIT_ROWS_FOR_AGENTS_NOT_UPDATED
+    uint32_t valueSize;      // 4 (float) or 8 (double), 1 or 2 for HISTORY_VALUES_FIXED
+    uint32_t recordSize;
+    uint32_t tickOffset;     // offsets of the fields within a record
+    uint32_t agentOffset;
+    uint32_t senderOffset;
+    uint32_t inputsOffset;
+    uint32_t outputsOffset;
+    uint32_t codec;          // HISTORY_CODEC_
+    uint32_t blockRecords;   // HISTORY_CODEC_ZLIB: maximum records in a block
+    uint32_t valueEncoding;  // HISTORY_VALUES_
+    float    valueScale;     // HISTORY_VALUES_FIXED: stored value of 1.0
+} HistoryFileHeader;
+
+typedef struct HistoryBlockHeader
+{
+    uint32_t nRecords;
+    uint32_t rawSize;        // bytes of the columns before compression
+    uint32_t compressedSize;
+    int32_t  firstTick;
+    int32_t  lastTick;
+    uint32_t reserved;
+} HistoryBlockHeader;
+
+typedef struct HistoryIndexEntry
+{
+    uint64_t offset;         // of the block header in the file
+    uint64_t firstRecord;    // number of the first record of the block
+    uint32_t nRecords;
+    int32_t  firstTick;
+    int32_t  lastTick;
+    uint32_t reserved;
+} HistoryIndexEntry;
+
+typedef struct HistoryIndexTrailer
+{
+    char     magic[8];       // HISTORY_INDEX_MAGIC
+    uint64_t indexOffset;
+    uint64_t nBlocks;
+} HistoryIndexTrailer;
+
+#endif
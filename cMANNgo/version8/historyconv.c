@@ -0,0 +1,100 @@
+// historyconv: converts a binary history (history_%d.bin, see history.h) written by social
+// into the text format of history_%d.txt, so that existing analysis scripts keep working.
+//
+// usage: historyconv [-t FIRST LAST] history_0.bin [history_0.txt]
+//
+// Without a second file name the output file name is the input name with .bin replaced by
+// .txt.  With -t only the rows of ticks FIRST to LAST are converted, found by binary search
+// (see historyread.h) instead of going through the whole file.  The parameters stored
+// in the header are printed with -p instead of converting:
+//
+//        historyconv -p history_0.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "historyread.h"
+
+int main(int argc, char *argv[])
+{
+    int printParameters = 0;
+    int first = INT_MIN, last = INT_MAX;
+    char outName[4096];
+    int arg = 1;
+    size_t n;
+
+    if (arg < argc && strcmp(argv[arg], "-p") == 0)
+    {
+        printParameters = 1;
+        arg++;
+    }
+    else if (arg + 2 < argc && strcmp(argv[arg], "-t") == 0)
+    {
+        first = atoi(argv[arg + 1]);
+        last  = atoi(argv[arg + 2]);
+        arg += 3;
+    }
+
+    if (arg >= argc || argc - arg > (printParameters ? 1 : 2))
+    {
+        printf("usage: historyconv [-t FIRST LAST] history_N.bin [history_N.txt]\n       historyconv -p history_N.bin\n");
+        exit(1);
+    }
+
+    const char *inName = argv[arg];
+    HistoryReader *in = openHistoryReader(inName);
+
+    if (!in)
+        exit(1);
+
+    if (printParameters)
+    {
+        fputs(in->parameters, stdout);
+        closeHistoryReader(in);
+        return 0;
+    }
+
+    if (arg + 1 < argc)
+        snprintf(outName, sizeof(outName), "%s", argv[arg + 1]);
+    else
+    {
+        snprintf(outName, sizeof(outName), "%s", inName);
+        n = strlen(outName);
+
+        if (n > 4 && strcmp(outName + n - 4, ".bin") == 0)
+            outName[n - 4] = '\0';
+
+        strncat(outName, ".txt", sizeof(outName) - strlen(outName) - 1);
+    }
+
+    FILE *out = fopen(outName, "w");
+
+    if (!out)
+    {
+        printf("COULD NOT WRITE %s\n", outName);
+        exit(1);
+    }
+
+    fprintf(out, "<tick#> <agent#> <1 if receiving agent> <sending agent#> <%d inputs> <%d outputs>\n\n",
+            in->header.nFeatures, in->header.nFeatures);
+
+    long nRecords = 0;
+
+    for (uint64_t i = historyFirstRecordAtTick(in, first); i < in->nRecords; i++)
+    {
+        const char *record = historyRecord(in, i);
+
+        if (historyTick(in, record) > last)
+            break;
+
+        writeHistoryRecordText(out, in, record);
+        nRecords++;
+    }
+
+    closeHistoryReader(in);
+    fclose(out);
+
+    printf("%ld rows written to %s\n", nRecords, outName);
+    return 0;
+}
@@ -0,0 +1,222 @@
+// historyquery: prints slices of a binary history (history_%d.bin, see history.h) without
+// going through the whole file, using historyread.
+//
+// usage: historyquery history_0.bin agent A [FIRST LAST]    rows of agent A
+//        historyquery history_0.bin outputs T               outputs of every agent after tick T
+//        historyquery history_0.bin prototype [FIRST LAST]  rows whose input was a prototype distortion
+//        historyquery history_0.bin ticks FIRST LAST        rows of ticks FIRST to LAST
+//        historyquery history_0.bin compare other.bin [T]   differences from the outputs of other.bin
+//
+// Rows are printed as in history_%d.txt.  outputs prints a line per agent: the agent number,
+// the tick of the agent's last row up to T (-1 if it has none, as when rows of agents that
+// were not updated are omitted and the agent has not received yet) and its outputs.  The
+// agent and prototype queries use the agent index (history_0.agents), which is built the
+// first time it is needed.
+//
+// compare measures how far the outputs of two histories of runs with the same SEED are apart,
+// for instance a run with weights stored in 16 bits from the full precision run: the mean and
+// largest absolute difference of the outputs of the same rows, and the fraction of outputs on
+// different sides of T (0.5 by default, METRICS_THRESHOLD), for each tenth of the ticks and
+// for the whole run.  The rows must be the same (same ticks, agents and senders), as they are
+// when the weights do not change which agents are chosen.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "historyread.h"
+
+static void usage(void)
+{
+    printf("usage: historyquery history_N.bin agent A [FIRST LAST]\n"
+           "       historyquery history_N.bin outputs T\n"
+           "       historyquery history_N.bin prototype [FIRST LAST]\n"
+           "       historyquery history_N.bin ticks FIRST LAST\n"
+           "       historyquery history_N.bin compare other.bin [THRESHOLD]\n");
+    exit(1);
+}
+
+// prints the rows of refs with ticks first .. last
+static long printRefs(HistoryReader *r, const HistoryRecordRef *refs, uint64_t n, int first, int last)
+{
+    long nRows = 0;
+
+    for (uint64_t k = firstRefAtTick(refs, n, first); k < n && refs[k].tick <= last; k++)
+    {
+        writeHistoryRecordText(stdout, r, historyRecord(r, refs[k].record));
+        nRows++;
+    }
+    return nRows;
+}
+
+typedef struct Differences
+{
+    long   nOutputs;
+    long   nFlipped;       // on different sides of the threshold
+    double sum;
+    double max;
+} Differences;
+
+static void printDifferences(const char *label, const Differences *d)
+{
+    printf("%s: mean |difference| %.6f, max %.6f, %.4f%% of %ld outputs on the other side of the threshold\n",
+           label, d->nOutputs ? d->sum / d->nOutputs : 0.0, d->max,
+           d->nOutputs ? 100.0 * d->nFlipped / d->nOutputs : 0.0, d->nOutputs);
+}
+
+static void compareHistories(HistoryReader *r, const char *otherName, double threshold)
+{
+    HistoryReader *o = openHistoryReader(otherName);
+    Differences all = { 0 }, part[10] = { { 0 } };
+    int nFeatures = r->header.nFeatures;
+
+    if (!o)
+        exit(1);
+
+    if (o->header.nFeatures != nFeatures || o->nRecords != r->nRecords || r->nRecords == 0)
+    {
+        printf("%s AND %s DO NOT HAVE THE SAME ROWS\n", r->filename, otherName);
+        exit(1);
+    }
+
+    int32_t lastTick = historyTick(r, historyRecord(r, r->nRecords - 1));
+
+    for (uint64_t i = 0; i < r->nRecords; i++)
+    {
+        const char *a = historyRecord(r, i);
+        const char *b = historyRecord(o, i);
+        int32_t tick = historyTick(r, a);
+
+        if (tick != historyTick(o, b) || historyAgent(r, a) != historyAgent(o, b) ||
+            historySender(r, a) != historySender(o, b))
+        {
+            printf("ROW %llu DIFFERS: TICK %d AGENT %d IN ONE, TICK %d AGENT %d IN THE OTHER\n", (unsigned long long)i,
+                   tick, historyAgent(r, a), historyTick(o, b), historyAgent(o, b));
+            exit(1);
+        }
+
+        Differences *d = &part[lastTick > 0 ? (int)((int64_t)tick * 10 / (lastTick + 1)) : 0];
+
+        for (int k = 0; k < nFeatures; k++)
+        {
+            double x = historyOutput(r, a, k), y = historyOutput(o, b, k);
+            double diff = fabs(x - y);
+            int flipped = (x >= threshold) != (y >= threshold);
+
+            d->nOutputs++;
+            d->nFlipped += flipped;
+            d->sum += diff;
+            if (diff > d->max)
+                d->max = diff;
+        }
+    }
+
+    for (int p = 0; p < 10; p++)
+    {
+        char label[64];
+
+        snprintf(label, sizeof(label), "ticks %lld-%lld", (long long)p * (lastTick + 1) / 10,
+                 (long long)(p + 1) * (lastTick + 1) / 10 - 1);
+        printDifferences(label, &part[p]);
+
+        all.nOutputs += part[p].nOutputs;
+        all.nFlipped += part[p].nFlipped;
+        all.sum += part[p].sum;
+        if (part[p].max > all.max)
+            all.max = part[p].max;
+    }
+
+    printDifferences("all ticks", &all);
+    closeHistoryReader(o);
+}
+
+int main(int argc, char *argv[])
+{
+    int first = INT_MIN, last = INT_MAX;
+    const HistoryRecordRef *refs;
+    uint64_t n;
+
+    if (argc < 3)
+        usage();
+
+    HistoryReader *r = openHistoryReader(argv[1]);
+    const char *query = argv[2];
+
+    if (!r)
+        exit(1);
+
+    if (strcmp(query, "agent") == 0 && (argc == 4 || argc == 6))
+    {
+        int agent = atoi(argv[3]);
+
+        if (argc == 6)
+        {
+            first = atoi(argv[4]);
+            last  = atoi(argv[5]);
+        }
+
+        if (agent < 0 || agent >= r->header.nAgents)
+        {
+            printf("NO AGENT %d IN %s (%d agents)\n", agent, argv[1], r->header.nAgents);
+            exit(1);
+        }
+
+        loadHistoryAgentIndex(r);
+        n = historyAgentRecords(r, agent, &refs);
+        printRefs(r, refs, n, first, last);
+    }
+    else if (strcmp(query, "prototype") == 0 && (argc == 3 || argc == 5))
+    {
+        if (argc == 5)
+        {
+            first = atoi(argv[3]);
+            last  = atoi(argv[4]);
+        }
+
+        loadHistoryAgentIndex(r);
+        n = historyPrototypeRecords(r, &refs);
+        printRefs(r, refs, n, first, last);
+    }
+    else if (strcmp(query, "outputs") == 0 && argc == 4)
+    {
+        int nAgents = r->header.nAgents, nFeatures = r->header.nFeatures;
+        double *outputs = malloc((size_t)nAgents * nFeatures * sizeof(double));
+        int32_t *rowTick = malloc((size_t)nAgents * sizeof(int32_t));
+
+        historyOutputsAtTick(r, atoi(argv[3]), outputs, rowTick);
+
+        for (int a = 0; a < nAgents; a++)
+        {
+            printf("%d %d ", a, rowTick[a]);
+            for (int i = 0; i < nFeatures; i++)
+                printf("%f ", outputs[(size_t)a * nFeatures + i]);
+            printf("\n");
+        }
+
+        free(outputs);
+        free(rowTick);
+    }
+    else if (strcmp(query, "compare") == 0 && (argc == 4 || argc == 5))
+        compareHistories(r, argv[3], argc == 5 ? atof(argv[4]) : 0.5);
+    else if (strcmp(query, "ticks") == 0 && argc == 5)
+    {
+        first = atoi(argv[3]);
+        last  = atoi(argv[4]);
+
+        for (uint64_t i = historyFirstRecordAtTick(r, first); i < r->nRecords; i++)
+        {
+            const char *record = historyRecord(r, i);
+
+            if (historyTick(r, record) > last)
+                break;
+
+            writeHistoryRecordText(stdout, r, record);
+        }
+    }
+    else
+        usage();
+
+    closeHistoryReader(r);
+    return 0;
+}
@@ -0,0 +1,660 @@
+// historyread: memory mapped access to binary histories, see historyread.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "historyread.h"
+
+static void corrupt(const HistoryReader *r)
+{
+    printf("CORRUPT HISTORY FILE %s\n", r->filename);
+    exit(1);
+}
+
+// value i of the values at p
+static double valueAt(const HistoryFileHeader *h, const char *p, int i)
+{
+    p += (size_t)i * h->valueSize;
+
+    if (h->valueEncoding == HISTORY_VALUES_FIXED)
+    {
+        if (h->valueSize == 1)
+            return *(const uint8_t *)p / (double)h->valueScale;
+        else
+        {
+            uint16_t q;
+            memcpy(&q, p, sizeof(q));
+            return q / (double)h->valueScale;
+        }
+    }
+    else if (h->valueSize == sizeof(float))
+    {
+        float v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    else
+    {
+        double v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+}
+
+// stores 0 or 1 as value i of the values at p
+static void setBinaryValue(const HistoryFileHeader *h, char *p, int i, int on)
+{
+    p += (size_t)i * h->valueSize;
+
+    if (h->valueEncoding == HISTORY_VALUES_FIXED)
+    {
+        uint16_t q = on ? (uint16_t)h->valueScale : 0;
+
+        if (h->valueSize == 1)
+            *(uint8_t *)p = (uint8_t)q;
+        else
+            memcpy(p, &q, sizeof(q));
+    }
+    else if (h->valueSize == sizeof(float))
+    {
+        float v = on;
+        memcpy(p, &v, sizeof(v));
+    }
+    else
+    {
+        double v = on;
+        memcpy(p, &v, sizeof(v));
+    }
+}
+
+static int32_t fieldAt(const char *record, uint32_t offset)
+{
+    int32_t v;
+
+    memcpy(&v, record + offset, sizeof(v));
+    return v;
+}
+
+int32_t historyTick(const HistoryReader *r, const char *record)
+{
+    return fieldAt(record, r->header.tickOffset);
+}
+
+int32_t historyAgent(const HistoryReader *r, const char *record)
+{
+    return fieldAt(record, r->header.agentOffset);
+}
+
+int32_t historySender(const HistoryReader *r, const char *record)
+{
+    return fieldAt(record, r->header.senderOffset);
+}
+
+double historyInput(const HistoryReader *r, const char *record, int i)
+{
+    return valueAt(&r->header, record + r->header.inputsOffset, i);
+}
+
+double historyOutput(const HistoryReader *r, const char *record, int i)
+{
+    return valueAt(&r->header, record + r->header.outputsOffset, i);
+}
+
+HistoryReader *openHistoryReader(const char *filename)
+{
+    HistoryReader *r = calloc(1, sizeof(HistoryReader));
+    HistoryFileHeader *h = &r->header;
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    snprintf(r->filename, sizeof(r->filename), "%s", filename);
+    r->cachedBlock = -1;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("COULD NOT OPEN %s\n", filename);
+        if (fd >= 0)
+            close(fd);
+        free(r);
+        return NULL;
+    }
+
+    r->mapSize = st.st_size;
+    r->map = (r->mapSize >= sizeof(*h)) ? mmap(NULL, r->mapSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (r->map == MAP_FAILED || memcmp(r->map, HISTORY_MAGIC, sizeof(h->magic)) != 0)
+    {
+        printf("%s IS NOT A BINARY HISTORY FILE\n", filename);
+        if (r->map != MAP_FAILED)
+            munmap((void *)r->map, r->mapSize);
+        free(r);
+        return NULL;
+    }
+
+    memcpy(h, r->map, sizeof(*h));
+
+    int fixed = (h->valueEncoding == HISTORY_VALUES_FIXED);
+
+    if (h->version != HISTORY_VERSION || h->byteOrder != HISTORY_BYTE_ORDER ||
+        (h->valueEncoding != HISTORY_VALUES_REAL && !fixed) ||
+        (!fixed && h->valueSize != sizeof(float) && h->valueSize != sizeof(double)) ||
+        (fixed && h->valueSize != 1 && h->valueSize != 2) ||
+        (h->codec != HISTORY_CODEC_NONE && h->codec != HISTORY_CODEC_ZLIB) ||
+        h->headerSize > r->mapSize || sizeof(*h) + h->parametersSize > h->headerSize)
+    {
+        printf("UNSUPPORTED HISTORY FILE %s (version %u, value size %u)\n", filename, h->version, h->valueSize);
+        munmap((void *)r->map, r->mapSize);
+        free(r);
+        return NULL;
+    }
+
+    r->parameters = calloc(h->parametersSize + 1, 1);
+    memcpy(r->parameters, r->map + sizeof(*h), h->parametersSize);
+
+    if (h->codec == HISTORY_CODEC_NONE)
+    {
+        // a history still being written may end with part of a record
+        r->records = r->map + h->headerSize;
+        r->nRecords = (r->mapSize - h->headerSize) / h->recordSize;
+        return r;
+    }
+
+    HistoryIndexTrailer trailer;
+
+    if (r->mapSize < h->headerSize + sizeof(trailer) ||
+        (memcpy(&trailer, r->map + r->mapSize - sizeof(trailer), sizeof(trailer)),
+         memcmp(trailer.magic, HISTORY_INDEX_MAGIC, sizeof(trailer.magic)) != 0))
+    {
+        printf("COMPRESSED HISTORY %s HAS NO BLOCK INDEX (the run did not finish?)\n", filename);
+        closeHistoryReader(r);
+        return NULL;
+    }
+
+    if (trailer.indexOffset + trailer.nBlocks * sizeof(HistoryIndexEntry) > r->mapSize - sizeof(trailer))
+        corrupt(r);
+
+    // copied, since the index need not be aligned in the file
+    r->nBlocks = trailer.nBlocks;
+    r->blocks = malloc((r->nBlocks ? r->nBlocks : 1) * sizeof(HistoryIndexEntry));
+    memcpy(r->blocks, r->map + trailer.indexOffset, r->nBlocks * sizeof(HistoryIndexEntry));
+    r->block = malloc((size_t)h->blockRecords * h->recordSize);
+
+    if (r->nBlocks > 0)
+        r->nRecords = r->blocks[r->nBlocks - 1].firstRecord + r->blocks[r->nBlocks - 1].nRecords;
+
+    return r;
+}
+
+void closeHistoryReader(HistoryReader *r)
+{
+    if (!r)
+        return;
+
+    if (r->agentIndexMapped)
+        munmap(r->agentIndex, r->agentIndexSize);
+    else
+        free(r->agentIndex);
+
+    munmap((void *)r->map, r->mapSize);
+    free(r->parameters);
+    free(r->blocks);
+    free(r->block);
+    free(r);
+}
+
+static const char *unshuffleBytes(char *to, const char *from, size_t count, size_t width)
+{
+    for (size_t b = 0; b < width; b++)
+        for (size_t i = 0; i < count; i++)
+            to[i * width + b] = *from++;
+
+    return from;
+}
+
+// Decodes compressed block b into r->block as fixed width records (see the format in
+// history.h): undoes the zlib compression, the byte shuffling, the delta coding of ticks
+// and agents, the bit packing of binary inputs and the XOR of the outputs of an agent with
+// those of its previous record in the block.
+static void decodeBlock(HistoryReader *r, uint64_t b)
+{
+    const HistoryFileHeader *h = &r->header;
+    HistoryBlockHeader bh;
+    size_t valuesSize = (size_t)h->nFeatures * h->valueSize;
+    size_t bitBytes = (h->nFeatures + 7) / 8;
+    uint64_t offset = r->blocks[b].offset;
+
+    if (offset + sizeof(bh) > r->mapSize)
+        corrupt(r);
+
+    memcpy(&bh, r->map + offset, sizeof(bh));
+
+    if (bh.nRecords > h->blockRecords || offset + sizeof(bh) + bh.compressedSize > r->mapSize)
+        corrupt(r);
+
+    uint32_t n = bh.nRecords;
+    char *raw = malloc(bh.rawSize ? bh.rawSize : 1);
+    char *columns = malloc(3 * sizeof(int32_t) * (size_t)n + 2 * valuesSize * n + 1);
+    uLongf rawSize = bh.rawSize;
+
+    if (uncompress((Bytef *)raw, &rawSize, (const Bytef *)r->map + offset + sizeof(bh), bh.compressedSize) != Z_OK ||
+        rawSize != bh.rawSize || rawSize < (3 * sizeof(int32_t) + 1) * (size_t)n)
+        corrupt(r);
+
+    int32_t *ints   = (int32_t *)columns;    // tick, agent and sender columns
+    char    *values = columns + 3 * sizeof(int32_t) * (size_t)n;
+    const char *p   = unshuffleBytes(columns, raw, 3 * (size_t)n, sizeof(int32_t));
+    const uint8_t *mode = (const uint8_t *)p;
+    const uint8_t *bits = mode + n;
+    size_t nBitRecords = 0, nValueRecords = 0;
+
+    for (uint32_t k = 0; k < n; k++)
+    {
+        if (mode[k] == HISTORY_INPUTS_BITS)
+            nBitRecords++;
+        else if (mode[k] == HISTORY_INPUTS_VALUES)
+            nValueRecords++;
+    }
+
+    p = (const char *)bits + nBitRecords * bitBytes;
+
+    if ((size_t)(p - raw) + (nValueRecords + n) * valuesSize != bh.rawSize)
+        corrupt(r);
+
+    p = unshuffleBytes(values, p, nValueRecords * h->nFeatures, h->valueSize);      // input values
+    unshuffleBytes(values + nValueRecords * valuesSize, p, (size_t)n * h->nFeatures, h->valueSize); // outputs
+
+    const char *inputValues = values;
+    const char *outputs = values + nValueRecords * valuesSize;
+    int32_t tick = 0, agent = 0;
+    int32_t *lastRecord;   // per agent, 1 + its last record in the block
+    int32_t maxAgent = -1;
+
+    for (uint32_t k = 0; k < n; k++)
+    {
+        agent += ints[n + k];
+        if (agent > maxAgent)
+            maxAgent = agent;
+    }
+
+    lastRecord = calloc((size_t)maxAgent + 2, sizeof(int32_t));
+    agent = 0;
+
+    for (uint32_t k = 0; k < n; k++)
+    {
+        char *record = r->block + (size_t)k * h->recordSize;
+        char *in = record + h->inputsOffset;
+        char *out = record + h->outputsOffset;
+        int32_t sender = ints[2 * n + k];
+
+        tick  += ints[k];
+        agent += ints[n + k];
+
+        memset(record, 0, h->recordSize);
+        memcpy(record + h->tickOffset,   &tick,   sizeof(tick));
+        memcpy(record + h->agentOffset,  &agent,  sizeof(agent));
+        memcpy(record + h->senderOffset, &sender, sizeof(sender));
+
+        if (mode[k] == HISTORY_INPUTS_BITS)
+        {
+            for (int i = 0; i < h->nFeatures; i++)
+                setBinaryValue(h, in, i, (bits[i / 8] >> (i % 8)) & 1);
+
+            bits += bitBytes;
+        }
+        else if (mode[k] == HISTORY_INPUTS_VALUES)
+        {
+            memcpy(in, inputValues, valuesSize);
+            inputValues += valuesSize;
+        }
+
+        memcpy(out, outputs + (size_t)k * valuesSize, valuesSize);
+
+        if (agent >= 0)
+        {
+            if (lastRecord[agent])
+            {
+                const char *last = r->block + (size_t)(lastRecord[agent] - 1) * h->recordSize + h->outputsOffset;
+
+                for (size_t j = 0; j < valuesSize; j++)
+                    out[j] ^= last[j];
+            }
+
+            lastRecord[agent] = k + 1;
+        }
+    }
+
+    free(lastRecord);
+    free(columns);
+    free(raw);
+    r->cachedBlock = (int64_t)b;
+}
+
+// the block that holds record i
+static uint64_t blockOfRecord(const HistoryReader *r, uint64_t i)
+{
+    uint64_t lo = 0, hi = r->nBlocks - 1;
+
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+
+        if (r->blocks[mid].firstRecord <= i)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+const char *historyRecord(HistoryReader *r, uint64_t i)
+{
+    if (i >= r->nRecords)
+        return NULL;
+
+    if (r->header.codec == HISTORY_CODEC_NONE)
+        return r->records + i * r->header.recordSize;
+
+    if (r->cachedBlock < 0 || i < r->blocks[r->cachedBlock].firstRecord ||
+        i >= r->blocks[r->cachedBlock].firstRecord + r->blocks[r->cachedBlock].nRecords)
+        decodeBlock(r, blockOfRecord(r, i));
+
+    return r->block + (i - r->blocks[r->cachedBlock].firstRecord) * r->header.recordSize;
+}
+
+// first of records lo .. hi - 1 with a tick at or after tick, hi if there is none
+static uint64_t searchRecords(HistoryReader *r, uint64_t lo, uint64_t hi, int32_t tick)
+{
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (historyTick(r, historyRecord(r, mid)) < tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint64_t historyFirstRecordAtTick(HistoryReader *r, int32_t tick)
+{
+    if (r->header.codec == HISTORY_CODEC_NONE)
+        return searchRecords(r, 0, r->nRecords, tick);
+
+    // the first block that ends at or after tick, then within it
+    uint64_t lo = 0, hi = r->nBlocks;
+
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (r->blocks[mid].lastTick < tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == r->nBlocks)
+        return r->nRecords;
+
+    return searchRecords(r, r->blocks[lo].firstRecord, r->blocks[lo].firstRecord + r->blocks[lo].nRecords, tick);
+}
+
+uint64_t firstRefAtTick(const HistoryRecordRef *refs, uint64_t n, int32_t tick)
+{
+    uint64_t lo = 0, hi = n;
+
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (refs[mid].tick < tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void setAgentIndex(HistoryReader *r, void *index, size_t size, int mapped)
+{
+    const HistoryAgentIndexHeader *ih = index;
+
+    r->agentIndex = index;
+    r->agentIndexSize = size;
+    r->agentIndexMapped = mapped;
+    r->agentStart = (const uint64_t *)(ih + 1);
+    r->agentRecords = (const HistoryRecordRef *)(r->agentStart + ih->nAgents + 1);
+    r->prototypeRecords = r->agentRecords + r->agentStart[ih->nAgents];
+    r->nPrototypeRecords = ih->nPrototypeRecords;
+}
+
+// maps the agent index file if it was built from this history; returns whether it was
+static int mapAgentIndex(HistoryReader *r, const char *name)
+{
+    HistoryAgentIndexHeader ih;
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    void *map;
+
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ih) || read(fd, &ih, sizeof(ih)) != sizeof(ih) ||
+        memcmp(ih.magic, HISTORY_AGENT_INDEX_MAGIC, sizeof(ih.magic)) != 0 ||
+        ih.historySize != r->mapSize || ih.nRecords != r->nRecords || ih.nAgents != r->header.nAgents ||
+        ih.entrySize != sizeof(HistoryRecordRef) ||
+        (size_t)st.st_size < sizeof(ih) + ((size_t)ih.nAgents + 1) * sizeof(uint64_t) ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return 0;
+    }
+
+    close(fd);
+
+    size_t nEntries = ((const uint64_t *)((const HistoryAgentIndexHeader *)map + 1))[ih.nAgents];
+
+    if (sizeof(ih) + (ih.nAgents + 1) * sizeof(uint64_t) + (nEntries + ih.nPrototypeRecords) * sizeof(HistoryRecordRef)
+        != (size_t)st.st_size)
+    {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    setAgentIndex(r, map, st.st_size, 1);
+    return 1;
+}
+
+// builds the agent index in one pass over the history and writes it to name
+static void buildAgentIndex(HistoryReader *r, const char *name)
+{
+    int nAgents = r->header.nAgents;
+    uint64_t *count = calloc((size_t)nAgents + 1, sizeof(uint64_t));
+    uint64_t nEntries = 0, nPrototype = 0;
+
+    for (uint64_t i = 0; i < r->nRecords; i++)
+    {
+        const char *record = historyRecord(r, i);
+        int32_t agent = historyAgent(r, record);
+
+        if (agent >= 0 && agent < nAgents)
+        {
+            count[agent]++;
+            nEntries++;
+        }
+        if (historySender(r, record) == HISTORY_SENDER_PROTOTYPE)
+            nPrototype++;
+    }
+
+    size_t size = sizeof(HistoryAgentIndexHeader) + ((size_t)nAgents + 1) * sizeof(uint64_t) +
+                  (nEntries + nPrototype) * sizeof(HistoryRecordRef);
+    HistoryAgentIndexHeader *ih = calloc(1, size);
+
+    if (!ih)
+    {
+        printf("NOT ENOUGH MEMORY FOR THE AGENT INDEX OF %s\n", r->filename);
+        exit(1);
+    }
+
+    memcpy(ih->magic, HISTORY_AGENT_INDEX_MAGIC, sizeof(ih->magic));
+    ih->historySize = r->mapSize;
+    ih->nRecords = r->nRecords;
+    ih->nAgents = nAgents;
+    ih->entrySize = sizeof(HistoryRecordRef);
+    ih->nPrototypeRecords = nPrototype;
+
+    uint64_t *start = (uint64_t *)(ih + 1);
+    HistoryRecordRef *entries = (HistoryRecordRef *)(start + nAgents + 1);
+    HistoryRecordRef *prototype = entries + nEntries;
+
+    for (int a = 0; a < nAgents; a++)
+        start[a + 1] = start[a] + count[a];
+
+    memcpy(count, start, (size_t)nAgents * sizeof(uint64_t)); // next entry of each agent
+    nPrototype = 0;
+
+    for (uint64_t i = 0; i < r->nRecords; i++)
+    {
+        const char *record = historyRecord(r, i);
+        int32_t agent = historyAgent(r, record);
+        HistoryRecordRef ref = { i, historyTick(r, record), 0 };
+
+        if (agent >= 0 && agent < nAgents)
+            entries[count[agent]++] = ref;
+        if (historySender(r, record) == HISTORY_SENDER_PROTOTYPE)
+            prototype[nPrototype++] = ref;
+    }
+
+    free(count);
+    setAgentIndex(r, ih, size, 0);
+
+    // written under another name first so that a reader never sees half an index
+    char tmpName[4200];
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", name);
+    FILE *fp = fopen(tmpName, "wb");
+
+    if (!fp || fwrite(ih, 1, size, fp) != size || fclose(fp) != 0 || rename(tmpName, name) != 0)
+    {
+        printf("could not write %s, the agent index is only kept in memory\n", name);
+        remove(tmpName);
+    }
+}
+
+void loadHistoryAgentIndex(HistoryReader *r)
+{
+    char name[4200];
+    size_t n;
+
+    if (r->agentIndex)
+        return;
+
+    snprintf(name, sizeof(name), "%s", r->filename);
+    n = strlen(name);
+
+    if (n > 4 && strcmp(name + n - 4, ".bin") == 0)
+        name[n - 4] = '\0';
+
+    strncat(name, ".agents", sizeof(name) - strlen(name) - 1);
+
+    if (!mapAgentIndex(r, name))
+        buildAgentIndex(r, name);
+}
+
+uint64_t historyAgentRecords(const HistoryReader *r, int agent, const HistoryRecordRef **refs)
+{
+    if (!r->agentIndex || agent < 0 || agent >= r->header.nAgents)
+    {
+        *refs = NULL;
+        return 0;
+    }
+
+    *refs = r->agentRecords + r->agentStart[agent];
+    return r->agentStart[agent + 1] - r->agentStart[agent];
+}
+
+uint64_t historyPrototypeRecords(const HistoryReader *r, const HistoryRecordRef **refs)
+{
+    *refs = r->prototypeRecords;
+    return r->agentIndex ? r->nPrototypeRecords : 0;
+}
+
+static int compareRecordNumbers(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void historyOutputsAtTick(HistoryReader *r, int32_t tick, double *outputs, int32_t *rowTick)
+{
+    int nAgents = r->header.nAgents, nFeatures = r->header.nFeatures;
+    uint64_t *wanted = malloc(((size_t)nAgents + 1) * sizeof(uint64_t));
+    int nWanted = 0;
+
+    loadHistoryAgentIndex(r);
+
+    // the last row of each agent up to tick, found in the agent index
+    for (int a = 0; a < nAgents; a++)
+    {
+        const HistoryRecordRef *refs;
+        uint64_t n = historyAgentRecords(r, a, &refs);
+        uint64_t k = firstRefAtTick(refs, n, tick + 1);
+
+        rowTick[a] = -1;
+        for (int i = 0; i < nFeatures; i++)
+            outputs[(size_t)a * nFeatures + i] = 0.0;
+
+        if (k > 0)
+            wanted[nWanted++] = refs[k - 1].record;
+    }
+
+    // read in file order so that every compressed block is decoded once
+    qsort(wanted, nWanted, sizeof(uint64_t), compareRecordNumbers);
+
+    for (int w = 0; w < nWanted; w++)
+    {
+        const char *record = historyRecord(r, wanted[w]);
+        int32_t a = historyAgent(r, record);
+
+        rowTick[a] = historyTick(r, record);
+        for (int i = 0; i < nFeatures; i++)
+            outputs[(size_t)a * nFeatures + i] = historyOutput(r, record, i);
+    }
+
+    free(wanted);
+}
+
+void writeHistoryRecordText(FILE *out, const HistoryReader *r, const char *record)
+{
+    int32_t tick = historyTick(r, record), agent = historyAgent(r, record), sender = historySender(r, record);
+    int i;
+
+    if (sender == HISTORY_SENDER_PRETRAINING)
+        fprintf(out, "%d %d - - ", tick, agent);
+    else if (sender == HISTORY_SENDER_NONE)
+        fprintf(out, "%d %d 0 - ", tick, agent);
+    else if (sender == HISTORY_SENDER_PROTOTYPE)
+        fprintf(out, "%d %d 1 P ", tick, agent);
+    else
+        fprintf(out, "%d %d 1 %d ", tick, agent, sender);
+
+    for (i = 0; i < r->header.nFeatures; i++)
+    {
+        if (sender == HISTORY_SENDER_NONE)
+            fprintf(out, "- ");
+        else
+            fprintf(out, "%f ", historyInput(r, record, i));
+    }
+
+    for (i = 0; i < r->header.nFeatures; i++)
+        fprintf(out, "%f ", historyOutput(r, record, i));
+
+    fprintf(out, "\n");
+}
@@ -0,0 +1,102 @@
+// historyread: reads binary histories (history_%d.bin, see history.h) without going through
+// the whole file, for historyconv, historyquery and analysis programs.
+//
+// The history file is memory mapped.  Records are numbered from 0 in the order social wrote
+// them, which is also the order of their ticks, so the first record of a tick is found by
+// binary search: over the records themselves in an uncompressed history, and over the block
+// index and then the records of one block in a compressed one.  historyRecord returns a
+// record in the fixed width layout of the header whatever the codec; in a compressed history
+// it decodes the block that holds the record, and the last decoded block is kept, so
+// records should be asked for in increasing order where possible.
+//
+// Questions about agents are answered from an agent index, a sidecar file (the history file
+// name with .bin replaced by .agents) listing for every agent the numbers and ticks of its
+// records, followed by the same list for the records whose input was a distortion of the
+// prototype.  loadHistoryAgentIndex builds it in one pass over the history the first time
+// and maps it afterwards; it is rebuilt when the history file has changed size.
+
+#ifndef HISTORYREAD_H
+#define HISTORYREAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "history.h"
+
+#define HISTORY_AGENT_INDEX_MAGIC "CMHAGIDX"
+#define HISTORY_NO_RECORD UINT64_MAX
+
+typedef struct HistoryRecordRef
+{
+    uint64_t record;        // record number
+    int32_t  tick;
+    int32_t  reserved;
+} HistoryRecordRef;
+
+// An agent index file is a HistoryAgentIndexHeader, uint64_t agentStart[nAgents + 1] (the
+// records of agent a are entries agentStart[a] .. agentStart[a + 1] - 1), the agents'
+// HistoryRecordRef entries, and then nPrototypeRecords HistoryRecordRef entries.
+typedef struct HistoryAgentIndexHeader
+{
+    char     magic[8];       // HISTORY_AGENT_INDEX_MAGIC
+    uint64_t historySize;    // size of the history file it was built from
+    uint64_t nRecords;       // records in that history file
+    int32_t  nAgents;
+    uint32_t entrySize;      // sizeof(HistoryRecordRef)
+    uint64_t nPrototypeRecords;
+} HistoryAgentIndexHeader;
+
+typedef struct HistoryReader
+{
+    char              filename[4096];
+    HistoryFileHeader header;
+    char             *parameters;    // parameter text, NUL terminated
+    const char       *map;
+    size_t            mapSize;
+    uint64_t          nRecords;
+
+    const char       *records;       // HISTORY_CODEC_NONE: the records, in the map
+    HistoryIndexEntry *blocks;       // HISTORY_CODEC_ZLIB: the block index
+    uint64_t          nBlocks;
+    char             *block;         // records of block cachedBlock, decoded
+    int64_t           cachedBlock;
+
+    // agent index, once loadHistoryAgentIndex has been called
+    const uint64_t         *agentStart;
+    const HistoryRecordRef *agentRecords;
+    const HistoryRecordRef *prototypeRecords;
+    uint64_t                nPrototypeRecords;
+    void                   *agentIndex;     // the whole index, mapped or allocated
+    size_t                  agentIndexSize;
+    int                     agentIndexMapped;
+} HistoryReader;
+
+HistoryReader *openHistoryReader(const char *filename); // NULL if it cannot be read
+void closeHistoryReader(HistoryReader *r);
+
+const char *historyRecord(HistoryReader *r, uint64_t i);
+int32_t historyTick(const HistoryReader *r, const char *record);
+int32_t historyAgent(const HistoryReader *r, const char *record);
+int32_t historySender(const HistoryReader *r, const char *record);
+double historyInput(const HistoryReader *r, const char *record, int i);
+double historyOutput(const HistoryReader *r, const char *record, int i);
+
+// number of the first record of a tick at or after tick, nRecords if there is none
+uint64_t historyFirstRecordAtTick(HistoryReader *r, int32_t tick);
+
+void loadHistoryAgentIndex(HistoryReader *r);
+// the records of agent, in order; returns their number
+uint64_t historyAgentRecords(const HistoryReader *r, int agent, const HistoryRecordRef **refs);
+// the records whose input was a distortion of the prototype, in order; returns their number
+uint64_t historyPrototypeRecords(const HistoryReader *r, const HistoryRecordRef **refs);
+// first of the n refs with a tick at or after tick, n if there is none
+uint64_t firstRefAtTick(const HistoryRecordRef *refs, uint64_t n, int32_t tick);
+
+// Outputs of every agent as they were at the end of tick: outputs[a * nFeatures + i], and
+// in rowTick[a] the tick of the agent's row they come from (-1 and outputs of 0 if it has
+// none up to tick).  Loads the agent index.
+void historyOutputsAtTick(HistoryReader *r, int32_t tick, double *outputs, int32_t *rowTick);
+
+// writes a record as a line of history_%d.txt
+void writeHistoryRecordText(FILE *out, const HistoryReader *r, const char *record);
+
+#endif
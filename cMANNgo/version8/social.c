@@ -0,0 +1,6157 @@
+// Revision History.  This version contains the following features:
+//
+// Version 8 (October 18, 2026)
+// This version was called scalableGraphs because it is aimed at running
+// much larger populations.  After the graph is generated it is converted
+// into a compact AgentGraph (an edge array plus a CSR adjacency with 32 bit
+// agent ids), and chooseRandomConnection samples directly from it, so igraph
+// is no longer used inside the tick loop.  Graphs can also be generated
+// without igraph by multi-threaded native generators (Watts-Strogatz,
+// Erdos-Renyi G(n,m) and G(n,p) with a target mean degree, Barabasi-Albert
+// and stochastic block models) that build the CSR directly.  Their output
+// depends only on SEED and the run number, not on the number of threads.
+// The default graph is now the native WATTS_STROGATZ, so with the same SEED
+// the graphs, and so the histories, differ from those of version 7; set
+// graphType to IGRAPH_WATTS_STROGATZ for the igraph graph of version 7.
+// Edges can carry tie-strength weights, generated or read from a file, and
+// are then sampled in O(1) from a Walker alias table, or in O(log edges)
+// from a Fenwick tree when weights are reinforced during the run.  Edges
+// can be rewired during a run (randomly or by output similarity) with the
+// adjacency updated in place, and each rewiring is logged in a binary file.
+// Besides uniform edges, connections can be chosen receiver-first or
+// sender-first (a uniform agent, then a uniform neighbor) from degree tables.
+// Graphs can be saved in a binary format and loaded back with mmap, or read
+// from text edge lists, so pre-generated or empirical graphs can be reused.
+// Generated graphs are cached in memory and on disk under a key of their
+// generator parameters and seed, and every run now seeds igraph from SEED and
+// its run number, so a run's graph no longer depends on the earlier runs.
+// Agents can be renumbered after the graph is built (BFS, reverse Cuthill-McKee
+// or community order) so that neighbors are close together in memory; all
+// output files still use the original agent numbers.  Watts-Strogatz graphs
+// can also be kept implicitly, as a ring lattice computed on the fly plus a
+// table of its rewired edges, so huge populations need no edge list.
+// The history can be written as binary fixed width records (history_%d.bin,
+// see history.h) in large blocks instead of being formatted value by value;
+// historyconv turns such a file back into the usual history_%d.txt.  The
+// blocks are written to disk by a separate thread, and the time spent
+// writing and waiting for the writer is reported at the end of each run.
+// Binary histories can be compressed (HISTORY_COMPRESSED): every block is
+// split into delta coded and byte-shuffled columns, with binary inputs
+// packed in bits, and compressed with zlib; an index of the blocks at the
+// end of the file lets readers go straight to the ticks they need.
+// Outputs and social inputs can be stored in 8 or 16 bit fixed point
+// (HISTORY_QUANTIZE_BITS), with binary prototype inputs still exact.
+// historyPolicy records every tick, every Nth tick or only the ticks
+// touching a subset of agents, and SNAPSHOT_EVERY_K_TICKS adds the outputs
+// of all agents every K ticks.  Population metrics (mean output, agreement
+// with the uber prototype, pairwise distances and the number of distinct
+// output patterns) are kept up to date as agents change and written to
+// metrics_%d.txt every METRICS_EVERY_K_TICKS ticks, and the history can be
+// turned off (HISTORY_NONE).
+// historyquery, built on the historyread library, memory maps a binary
+// history and prints one agent's rows, the outputs of all agents at a tick
+// or the prototype inputs without reading the whole file.
+// Runs can be checkpointed every CHECKPOINT_EVERY_K_TICKS ticks, and
+// "social -restart" resumes them from their checkpoints with the same
+// history as if they had not been interrupted.
+// With WEIGHT_TEMPLATES the agents share one Lens network and their
+// weights are kept in blocks that start as copy-on-write templates.
+// With PRETRAINED_SNAPSHOTS as well, parameter combinations that differ
+// only in the parameters of the tick loop start from a copy of the same
+// pretrained weight blocks.
+// With LAZY_AGENTS as well, agents are created and pretrained when they
+// are first used instead of when the run starts.
+// The outputs and prototypes of the agents are allocated for each run,
+// so MAX_AGENTS and MAX_FEATURES are gone.  With AGENT_STATE_FILE they
+// are kept, with the weights, in a mapped file, with the pages of agents
+// asked for ahead from the schedule of SCHEDULE_LOOKAHEAD ticks.  The
+// receiver and sender of each tick are drawn from a random stream of
+// that tick, so drawing them ahead does not change the run; it also
+// means the connections chosen differ from those of earlier versions.
+// weightStorage can keep the blocks in bfloat16 or half precision, and
+// the agent arenas can have huge pages and a NUMA placement.
+//
+// Version 7 (April 10, 2018)
+// This version was called autoParamCombo because it adds the feature of
+// specifying vectors of one or more values for some parameters instead of
+// being limited to a single value for each parameter.  The program then
+// runs every possible combination of the set of values for each parameter.
+// The parameters for which a vector of values can be supplied are listed
+// in the function processAllParamCombos().  The elements of each vector
+// are entered in this function.  Define a one element vector if the
+// parameter is to take on only one value. Parameters for which this
+// vector feature is not enabled are specified as #define constants early
+// in the program. 
+//
+// Version 6 (March 27, 2018)
+// This version was called graphTypeChoice because it provides the choice of
+// using either the IGRAPH_WATTS_STROGATZ algorithm or the IGRAPH_ERDOS_RENYI
+// algorithm to randomly generate the graph with the specified number of
+// agents.
+//
+// Version 5 (March 12, 2018)
+// This version was called socialProbAlgorithms because it uses a specified
+// algorithm and parameter to compute the probability of using social
+// communication for input at each tick (as opposed to prototype).
+// It then makes a random choice between these alternatives with this
+// probability.
+//
+// Version 4 (March 7, 2018)
+// This version was called timing because it added the total runtime for all
+// runs to the screen output.
+//
+// Version 3 (March 6, 2018)
+// This version was called multirunFixed because it fixes a bug in
+// multirun that caused a memory leak in Lens.  It may also add some detail.
+// 
+// Version 2 (January 2018)
+// This version was called multirun because it adds the feature of running
+// cMaango with identical parameters multiple times.  N_RUNS is the number of
+// times to run.
+//
+// Version 1 (January 2018)
+// This version was called multiagent and is an early version of cMaango.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <lens.h>
+#include <util.h>
+#include <network.h>
+#include <igraph.h>
+#include "history.h"
+
+// Data Structures used by this model:
+
+// (1) Prototypes
+//	uber_prototype[i] (for each feature i)
+//	prototype[a][i] for each agent a (obtained from distortion of uber_prototype)
+//	exempler[i] for each epoch e and receiving agent a
+//
+// (2) Graph g (generated natively or by igraph, represented by AgentGraph agentGraph)
+//	numberAgentConnections = number of edges in graph
+//
+// (3) Lens network for internals of each agent, used to obtain its output as a function of its input
+//	lens("addNet agent_name ...");
+//	weights developed by training, updated at each epoch
+//
+// (4) Outputs of each agent, updated at each epoch
+#define AGENT_ROW_ALIGN 64  // bytes; outputs and prototype rows are padded to a multiple of it
+// n_features was formerly N_INPUTS = N_OUTPUTS
+
+#define N_RUNS     2
+
+// To seed random number generator based on time, specify a negative number for SEED,
+// otherwise SEED is used as the seed for all random number generators, including igraph.
+#define SEED       12345
+
+#define SOCIAL_PROB_ALGORITHM "constant"
+
+#define LEARNING_RATE 0.05
+#define MOMENTUM  0.9
+
+// parameters for WATTS_STROGATZ and IGRAPH_WATTS_STROGATZ
+#define NEIGHBORHOOD 4
+#define PROB_REWIRE  0.10
+
+// parameters for the other native graph generators
+#define MEAN_DEGREE        8.0  // target mean degree for ERDOS_RENYI_GNM, ERDOS_RENYI_GNP and STOCHASTIC_BLOCK
+#define BA_EDGES_PER_AGENT 4    // edges added with each new agent in BARABASI_ALBERT
+#define SBM_N_BLOCKS       10   // number of equal sized blocks in STOCHASTIC_BLOCK
+#define SBM_MIXING         0.1  // expected fraction of each agent's edges that leave its block
+
+// The native generators split the agents into work units of GRAPH_BLOCK_AGENTS agents, each with
+// its own random number stream, so the graph does not depend on the number of threads.
+#define GRAPH_THREADS      0    // 0 = one thread per online processor
+#define GRAPH_BLOCK_AGENTS 65536
+
+// Version of the graphs the generators build.  Increase it whenever a generator builds a
+// different graph from the same parameters and seed, so cached graphs are not reused.
+#define GRAPH_GENERATOR_VERSION 1
+
+// cache of generated graphs (see findCachedGraph)
+#define GRAPH_CACHE_MEMORY_ENTRIES 4             // 0 = no memory cache
+#define GRAPH_CACHE_DIR            "graph_cache" // "" = no disk cache; relative to the program directory
+
+// graph read by GRAPH_FROM_FILE: a binary graph file or a text edge list, %d = run number
+#define GRAPH_FILE "connections_%d.bin"
+
+// edge weights (see weightMode and weightSource)
+#define EDGE_WEIGHT_FILE       "edge_weights.dat" // absolute path when several combinations run in subdirectories
+#define WEIGHT_LOGNORMAL_SIGMA 1.0
+#define WEIGHT_REINFORCEMENT   0.1  // DYNAMIC_WEIGHTS: added to an edge's weight each time it carries social input
+
+// renumbering of agents for locality (see agentOrder)
+#define COMMUNITY_ROUNDS 10 // COMMUNITY_ORDER: label propagation sweeps
+
+// rewiring during a run (see rewireRule)
+#define REWIRE_RATE       0.0  // expected rewiring events per tick, 0 keeps the graph fixed
+#define REWIRE_CANDIDATES 8    // REWIRE_HOMOPHILY: agents examined as the new sender
+
+#define CMDLEN    100000
+
+#define DISPLAY_TO_SCREEN 0
+#define SAVE_WEIGHTS 0
+#define STORE_AGENT_CONNECTIONS 1
+#define STORE_AGENT_CONNECTIONS_BINARY 1 // also write connections_%d.bin, which GRAPH_FROM_FILE can load
+#define OMIT_ROWS_FOR_AGENTS_NOT_UPDATED 1
+#define HISTORY_BUFFER_BYTES (1 << 20) // HISTORY_BINARY: records are written in blocks of this size
+#define HISTORY_BUFFERS      4         // blocks in the ring shared with the writer thread
+#define HISTORY_WRITER_THREAD 1        // 0 = blocks are written by the simulation itself
+#define HISTORY_COMPRESSION_LEVEL 1    // HISTORY_COMPRESSED: zlib level, 1 (fastest) to 9 (smallest)
+#define HISTORY_QUANTIZE_BITS 0        // binary histories: 0 = exact values, 8 or 16 = fixed point
+#define HISTORY_EVERY_N_TICKS  100     // HISTORY_EVERY_NTH_TICK: ticks 0, N, 2N, ... are recorded
+#define HISTORY_AGENTS         "0-9"   // HISTORY_AGENT_SUBSET: original agent numbers, e.g. "0-9,42"
+#define SNAPSHOT_EVERY_K_TICKS 0       // outputs of all agents every K ticks whatever the policy, 0 = none
+#define METRICS_EVERY_K_TICKS  100     // population metrics in metrics_%d.txt every K ticks, 0 = none
+#define METRICS_THRESHOLD      0.5     // outputs at or above it count as 1 in the metrics
+#define CHECKPOINT_EVERY_K_TICKS 0     // complete state in checkpoint_%d.bin every K ticks, 0 = none
+#define PRETRAINED_SNAPSHOTS   0       // 1 = combinations with the same setup share pretraining and
+                                       // their agents' weights (needs WEIGHT_TEMPLATES, not LAZY_AGENTS)
+#define WEIGHT_TEMPLATES       0       // 0 = a Lens network per agent; N = one network, agents' weights
+                                       // in blocks starting as references to N shared templates;
+                                       // N < n_agents only with LAZY_AGENTS (see createAgentNets)
+#define LAZY_AGENTS            0       // 1 = agents are created on first use (needs WEIGHT_TEMPLATES)
+#define AGENT_STATE_FILE       ""      // "" = agent state in memory; else a file to map it from, %d = run
+                                       // (needs WEIGHT_TEMPLATES), e.g. "/scratch/agent_state_%d.bin"
+#define SCHEDULE_LOOKAHEAD     0       // ticks whose receiver and sender are drawn ahead, 0 = none
+#define AGENT_HUGE_PAGES       0       // agent arenas: 0 = normal pages, 1 = transparent huge pages,
+                                       // 2 = explicit huge pages (MAP_HUGETLB) if there are enough
+#define AGENT_NUMA_NODE        (-1)    // agent arenas: -1 = first touch, N = bind to node N,
+                                       // AGENT_NUMA_INTERLEAVE = spread over all nodes
+#define AGENT_NUMA_INTERLEAVE  (-2)    // value of AGENT_NUMA_NODE: interleave the arenas over all online nodes
+
+// defining CONNECTION_TYPE to be an IGRAPH._.. causes agent connection to be represented by edges in igraph network 
+#define USE_IGRAPH
+
+int n_agents;
+int n_ticks;
+int n_features;
+real proportion_hidden;
+int n_hidden;
+real proto_p_on;
+real proto_p_flip;
+real item_p_flip;
+real social_prob_parameter;
+
+
+real **outputs;  // current outputs of each agent, see allocAgentState
+		 // agents are numbered from 0 to n_agents-1 for compatibility with igraph
+real *uber_prototype;
+real **prototype;
+int numberAgentConnections;
+
+int rand_int(int max);  // random int from 0 to max-1
+uint64_t connectionEdge(int ac); // packed (receiver, sender) of edge id ac
+
+// The compact representation of the graph used during a run.  It is built once by
+// initAgentConnections from whatever produced the graph, and it is the only
+// representation used by chooseRandomConnection.
+//
+// edge[ac] holds the receiver (high 32 bits) and sender (low 32 bits) of edge id ac,
+// so sampling a uniformly distributed edge is a single array read.  Edge ids are the
+// same as those of the generator, so a given SEED selects the same connections as before.
+//
+// offset/sender is the CSR adjacency by receiver: the agents that agent r receives from
+// are sender[offset[r]] .. sender[offset[r+1] - 1].
+
+typedef struct AgentGraph
+{
+    int       nAgents;
+    int       nEdges;
+    uint64_t *edge;    // nEdges packed (receiver, sender) pairs, indexed by edge id
+    uint32_t *offset;  // nAgents + 1 entries
+    uint32_t *sender;  // nEdges entries
+    float    *weight;  // nEdges tie strengths indexed by edge id, NULL when UNWEIGHTED
+    void     *mapping; // set when the arrays are in a mapped graph file
+    size_t    mappingSize;
+} AgentGraph;
+
+AgentGraph agentGraph;
+
+static inline uint64_t packEdge(uint32_t receiver, uint32_t sender)
+{
+    return ((uint64_t)receiver << 32) | sender;
+}
+
+static inline uint32_t edgeReceiver(uint64_t e) { return (uint32_t)(e >> 32); }
+static inline uint32_t edgeSender(uint64_t e)   { return (uint32_t)e; }
+
+void allocAgentGraph(int nAgents, int nEdges)
+{
+    agentGraph.nAgents = nAgents;
+    agentGraph.nEdges  = nEdges;
+    agentGraph.edge    = malloc((size_t)nEdges * sizeof(uint64_t));
+    agentGraph.offset  = malloc((size_t)(nAgents + 1) * sizeof(uint32_t));
+    agentGraph.sender  = malloc((size_t)nEdges * sizeof(uint32_t));
+
+    if (!agentGraph.edge || !agentGraph.offset || !agentGraph.sender)
+    {
+        printf("OUT OF MEMORY FOR AGENT GRAPH (%d agents, %d edges)\n", nAgents, nEdges);
+        exit(1);
+    }
+}
+
+void releaseAgentGraph(AgentGraph *graph)
+{
+    if (graph->mapping)
+        munmap(graph->mapping, graph->mappingSize);
+    else
+    {
+        free(graph->edge);
+        free(graph->offset);
+        free(graph->sender);
+    }
+
+    // weights are in the mapping only when they came with the graph file
+    char *weight = (char *)graph->weight;
+    if (!graph->mapping || weight < (char *)graph->mapping || weight >= (char *)graph->mapping + graph->mappingSize)
+        free(graph->weight);
+
+    memset(graph, 0, sizeof(*graph));
+}
+
+void freeAgentGraph(void)
+{
+    releaseAgentGraph(&agentGraph);
+}
+
+// Builds the CSR adjacency from agentGraph.edge with a counting sort by receiver
+// (within each receiver, senders are in edge id order).
+void buildAgentGraphIndex(void)
+{
+    uint32_t *offset = agentGraph.offset;
+    int r;
+
+    memset(offset, 0, (size_t)(agentGraph.nAgents + 1) * sizeof(uint32_t));
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+        offset[edgeReceiver(agentGraph.edge[ac]) + 1]++;
+
+    for (r = 0; r < agentGraph.nAgents; r++)
+        offset[r + 1] += offset[r];
+
+    uint32_t *next = malloc((size_t)agentGraph.nAgents * sizeof(uint32_t));
+    memcpy(next, offset, (size_t)agentGraph.nAgents * sizeof(uint32_t));
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+    {
+        uint64_t e = agentGraph.edge[ac];
+        agentGraph.sender[next[edgeReceiver(e)]++] = edgeSender(e);
+    }
+
+    free(next);
+}
+
+// Binary graph files.  A graph is written in one pass as a GraphFileHeader followed by the
+// arrays of AgentGraph exactly as they are held in memory, each section starting on an
+// 8 byte boundary:
+//
+//   edge    uint64_t[nEdges]      packed (receiver, sender), indexed by edge id
+//   offset  uint32_t[nAgents + 1] CSR offsets by receiver
+//   sender  uint32_t[nEdges]      CSR senders
+//   weight  float[nEdges]         only when flags has GRAPH_FILE_HAS_WEIGHTS
+//   key     char[keyLength]       only in the graph cache: the text of its cache key
+//
+// Loading maps the file and points agentGraph at the sections, so there is no parsing.  The
+// mapping is private, so rewiring a loaded graph never modifies the file.  Text edge lists
+// in the connections_%d.txt format ("<receiver> <sender> [<weight>]" per line) can be
+// loaded as well, for empirical graphs that have not been converted yet.
+
+#define GRAPH_FILE_MAGIC       "CMGRAPH1"
+#define GRAPH_FILE_VERSION     1
+#define GRAPH_FILE_HAS_WEIGHTS 1
+
+typedef struct GraphFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t nAgents;
+    uint64_t nEdges;
+    uint64_t tag;           // hash of the key, 0 when unused
+    uint64_t edgeStart;     // byte offsets of the sections from the start of the file
+    uint64_t offsetStart;
+    uint64_t senderStart;
+    uint64_t weightStart;   // 0 without weights
+    uint64_t keyStart;      // 0 without a key
+    uint64_t keyLength;
+    uint64_t reserved[4];
+} GraphFileHeader;
+
+static inline uint64_t alignTo8(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
+
+static void writeGraphSection(FILE *fp, const void *data, size_t size)
+{
+    static const char padding[8];
+
+    fwrite(data, 1, size, fp);
+    fwrite(padding, 1, alignTo8(size) - size, fp);
+}
+
+// Writes agentGraph to filename (through a temporary file and a rename, so a reader never
+// sees a partial graph), with the graph cache key (NULL when unused) and its hash tag.
+// Returns 0 on success.
+int saveAgentGraph(const char *filename, const char *key, uint64_t tag)
+{
+    GraphFileHeader header;
+    char tmpname[strlen(filename) + 16];
+    FILE *fp;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAPH_FILE_MAGIC, 8);
+    header.version     = GRAPH_FILE_VERSION;
+    header.flags       = agentGraph.weight ? GRAPH_FILE_HAS_WEIGHTS : 0;
+    header.nAgents     = agentGraph.nAgents;
+    header.nEdges      = agentGraph.nEdges;
+    header.tag         = tag;
+    header.edgeStart   = alignTo8(sizeof(header));
+    header.offsetStart = header.edgeStart + alignTo8(header.nEdges * sizeof(uint64_t));
+    header.senderStart = header.offsetStart + alignTo8((header.nAgents + 1) * sizeof(uint32_t));
+    header.weightStart = agentGraph.weight ? header.senderStart + alignTo8(header.nEdges * sizeof(uint32_t)) : 0;
+    header.keyLength   = key ? strlen(key) : 0;
+    header.keyStart    = !key ? 0 : agentGraph.weight ? header.weightStart + alignTo8(header.nEdges * sizeof(float))
+                                                      : header.senderStart + alignTo8(header.nEdges * sizeof(uint32_t));
+
+    sprintf(tmpname, "%s.%d.tmp", filename, (int)getpid());
+
+    if (!(fp = fopen(tmpname, "wb")))
+        return 1;
+
+    writeGraphSection(fp, &header, sizeof(header));
+    writeGraphSection(fp, agentGraph.edge,   header.nEdges * sizeof(uint64_t));
+    writeGraphSection(fp, agentGraph.offset, (header.nAgents + 1) * sizeof(uint32_t));
+    writeGraphSection(fp, agentGraph.sender, header.nEdges * sizeof(uint32_t));
+
+    if (agentGraph.weight)
+        writeGraphSection(fp, agentGraph.weight, header.nEdges * sizeof(float));
+
+    if (key)
+        writeGraphSection(fp, key, header.keyLength);
+
+    if (fclose(fp) != 0 || rename(tmpname, filename) != 0)
+    {
+        unlink(tmpname);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Maps a binary graph file into agentGraph.  Returns 0 on success, 1 if the file cannot be
+// opened or is not a graph file; exits if it is a graph file that does not fit this run.
+// With a key (graph cache files), a file that does not fit the run or was not stored under
+// exactly that key returns 1 instead.
+int mapAgentGraph(const char *filename, const char *key)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    GraphFileHeader *header;
+
+    if (fd < 0)
+        return 1;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GraphFileHeader))
+    {
+        close(fd);
+        return 1;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return 1;
+
+    header = mapping;
+
+    if (memcmp(header->magic, GRAPH_FILE_MAGIC, 8) != 0)
+    {
+        munmap(mapping, st.st_size);
+        return 1;
+    }
+
+    uint64_t end = header->senderStart + header->nEdges * sizeof(uint32_t);
+
+    if (header->flags & GRAPH_FILE_HAS_WEIGHTS)
+        end = header->weightStart + header->nEdges * sizeof(float);
+
+    int fits = header->version == GRAPH_FILE_VERSION && header->nEdges <= INT32_MAX && end <= (uint64_t)st.st_size &&
+               header->nAgents == (uint64_t)n_agents;
+
+    if (key && (!fits || header->keyLength != strlen(key) || header->keyStart + header->keyLength > (uint64_t)st.st_size ||
+                memcmp((char *)mapping + header->keyStart, key, header->keyLength) != 0))
+    {
+        munmap(mapping, st.st_size);
+        return 1;
+    }
+
+    if (header->version != GRAPH_FILE_VERSION || header->nEdges > INT32_MAX || end > (uint64_t)st.st_size)
+    {
+        printf("INVALID GRAPH FILE %s\n", filename);
+        exit(1);
+    }
+
+    if (header->nAgents != (uint64_t)n_agents)
+    {
+        printf("GRAPH FILE %s HAS %llu AGENTS BUT THE RUN HAS %d\n", filename, (unsigned long long)header->nAgents, n_agents);
+        exit(1);
+    }
+
+    agentGraph.nAgents     = (int)header->nAgents;
+    agentGraph.nEdges      = (int)header->nEdges;
+    agentGraph.edge        = (uint64_t *)((char *)mapping + header->edgeStart);
+    agentGraph.offset      = (uint32_t *)((char *)mapping + header->offsetStart);
+    agentGraph.sender      = (uint32_t *)((char *)mapping + header->senderStart);
+    agentGraph.weight      = (header->flags & GRAPH_FILE_HAS_WEIGHTS) ? (float *)((char *)mapping + header->weightStart) : NULL;
+    agentGraph.mapping     = mapping;
+    agentGraph.mappingSize = st.st_size;
+    return 0;
+}
+
+// Reads a text edge list into agentGraph; weights are kept if every line has one.
+void readAgentGraphText(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    char line[256];
+    size_t n = 0, cap = 1024;
+    uint64_t *edge = malloc(cap * sizeof(uint64_t));
+    float *weight = malloc(cap * sizeof(float));
+    int allWeighted = 1;
+
+    if (!fp)
+    {
+        printf("COULD NOT OPEN GRAPH FILE %s\n", filename);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        unsigned receiver, sender;
+        float w;
+        int nFields = sscanf(line, "%u %u %f", &receiver, &sender, &w);
+
+        if (nFields < 2)
+            continue;
+
+        if (receiver >= (unsigned)n_agents || sender >= (unsigned)n_agents)
+        {
+            printf("GRAPH FILE %s HAS AGENT %u BUT THE RUN HAS %d AGENTS\n", filename, (receiver > sender) ? receiver : sender, n_agents);
+            exit(1);
+        }
+
+        if (n == cap)
+        {
+            cap *= 2;
+            edge = realloc(edge, cap * sizeof(uint64_t));
+            weight = realloc(weight, cap * sizeof(float));
+        }
+
+        edge[n] = packEdge(receiver, sender);
+        weight[n] = (nFields == 3) ? w : 1.0f;
+        allWeighted &= (nFields == 3);
+        n++;
+    }
+
+    fclose(fp);
+
+    if (n > INT32_MAX)
+    {
+        printf("TOO MANY AGENT CONNECTIONS IN %s\n", filename);
+        exit(1);
+    }
+
+    allocAgentGraph(n_agents, (int)n);
+    memcpy(agentGraph.edge, edge, n * sizeof(uint64_t));
+    buildAgentGraphIndex();
+
+    free(edge);
+
+    if (allWeighted && n > 0)
+        agentGraph.weight = realloc(weight, n * sizeof(float));
+    else
+        free(weight);
+}
+
+// GRAPH_FILE may contain a %d, which is replaced by the run number
+void graphFileName(char *filename, size_t size, int runNum)
+{
+    const char *pattern = GRAPH_FILE;
+
+    snprintf(filename, size, pattern, runNum);
+}
+
+void loadAgentGraph(int runNum)
+{
+    char filename[1024];
+
+    graphFileName(filename, sizeof(filename), runNum);
+
+    if (mapAgentGraph(filename, NULL) != 0)
+        readAgentGraphText(filename);
+
+    printf("graph loaded from %s%s\n", filename, agentGraph.mapping ? " (mapped)" : "");
+}
+
+// Called at the end of initAgentConnections, once the graph of nConnections edges is complete.
+void finishAgentConnections(int runNum, int nConnections)
+{
+    numberAgentConnections = nConnections;
+    printf("there are %d agent connections\n\n", numberAgentConnections);
+
+    if (STORE_AGENT_CONNECTIONS)
+    {
+	FILE *fp;
+	char filename[40];
+
+	sprintf(filename, "connections_%d.txt", runNum);
+	fp = fopen(filename, "w");
+
+	for (int ac = 0; ac < numberAgentConnections; ac++) // ac = each edge id
+	{
+	    uint64_t e = connectionEdge(ac);
+
+	    if (agentGraph.weight)
+	        fprintf(fp, "%u %u %f\n", edgeReceiver(e), edgeSender(e), agentGraph.weight[ac]);
+	    else
+	        fprintf(fp, "%u %u\n", edgeReceiver(e), edgeSender(e));
+	}
+
+	fclose(fp);
+    }
+
+    if (STORE_AGENT_CONNECTIONS_BINARY && agentGraph.nEdges == numberAgentConnections) // not for implicit graphs
+    {
+	char filename[40];
+
+	sprintf(filename, "connections_%d.bin", runNum);
+
+	if (saveAgentGraph(filename, NULL, 0) != 0)
+	    printf("COULD NOT WRITE %s\n", filename);
+    }
+}
+
+// The generation of the graph is contained within this section.
+
+typedef enum {WATTS_STROGATZ, ERDOS_RENYI_GNM, ERDOS_RENYI_GNP, BARABASI_ALBERT, STOCHASTIC_BLOCK,
+              IMPLICIT_WATTS_STROGATZ, IGRAPH_WATTS_STROGATZ, IGRAPH_ERDOS_RENYI, FIXED_AGENT_CONNECTIONS, GRAPH_FROM_FILE} Graph_type;
+
+Graph_type graphType = WATTS_STROGATZ;  // not version 7's IGRAPH_WATTS_STROGATZ: other graphs for a SEED
+
+const char *graphTypeName(Graph_type type)
+{
+    switch(type)
+    {
+        case WATTS_STROGATZ:          return "WATTS_STROGATZ";
+        case ERDOS_RENYI_GNM:         return "ERDOS_RENYI_GNM";
+        case ERDOS_RENYI_GNP:         return "ERDOS_RENYI_GNP";
+        case BARABASI_ALBERT:         return "BARABASI_ALBERT";
+        case STOCHASTIC_BLOCK:        return "STOCHASTIC_BLOCK";
+        case IMPLICIT_WATTS_STROGATZ: return "IMPLICIT_WATTS_STROGATZ";
+        case IGRAPH_WATTS_STROGATZ:   return "IGRAPH_WATTS_STROGATZ";
+        case IGRAPH_ERDOS_RENYI:      return "IGRAPH_ERDOS_RENYI";
+        case FIXED_AGENT_CONNECTIONS: return "FIXED_AGENT_CONNECTIONS";
+        case GRAPH_FROM_FILE:         return "GRAPH_FROM_FILE";
+    }
+    return "UNKNOWN";
+}
+
+// Random number streams for the native graph generators.  Each work unit draws from its
+// own splitmix64 stream derived from the graph seed, the generator and the unit number,
+// so the same seed always gives the same graph however the units are spread over threads.
+
+typedef struct GraphRng
+{
+    uint64_t state;
+} GraphRng;
+
+static inline uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+GraphRng graphRngStream(uint64_t seed, int generator, uint64_t unit)
+{
+    GraphRng rng;
+    uint64_t mix = seed ^ ((uint64_t)generator << 56) ^ (unit * 0xD1B54A32D192ED03ULL);
+
+    rng.state = splitmix64(&mix);
+    return rng;
+}
+
+static inline double graphRngReal(GraphRng *rng) // uniformly dist in [0.0, 1.0)
+{
+    return (double)(splitmix64(&rng->state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint32_t graphRngInt(GraphRng *rng, uint32_t max) // random int from 0 to max-1
+{
+    return (uint32_t)(((splitmix64(&rng->state) >> 32) * (uint64_t)max) >> 32);
+}
+
+#define WEIGHT_STREAM 255 // generator numbers of the streams used for generated edge weights
+#define REWIRE_STREAM 254 // and for rewiring during a run
+#define AGENT_STREAM  253 // and for the pretraining of agents created on first use (LAZY_AGENTS)
+
+// number of failures before the first success of Bernoulli(p) trials, used to skip
+// directly to the next selected pair in the sparse generators
+static inline uint64_t graphRngGeometric(GraphRng *rng, double p)
+{
+    if (p >= 1.0)
+        return 0;
+    if (p <= 0.0)
+        return UINT64_MAX;
+
+    double g = floor(log(1.0 - graphRngReal(rng)) / log(1.0 - p));
+    return (g >= 1.8e19) ? UINT64_MAX : (uint64_t)g;
+}
+
+// Undirected edges produced by one work unit, as (a, b) pairs.
+typedef struct EdgeBuffer
+{
+    uint32_t *pair;
+    size_t    n;
+    size_t    cap;
+} EdgeBuffer;
+
+static inline void addEdgeToBuffer(EdgeBuffer *buf, uint32_t a, uint32_t b)
+{
+    if (buf->n == buf->cap)
+    {
+        buf->cap  = buf->cap ? 2 * buf->cap : 1024;
+        buf->pair = realloc(buf->pair, 2 * buf->cap * sizeof(uint32_t));
+
+        if (!buf->pair)
+        {
+            printf("OUT OF MEMORY IN GRAPH GENERATOR\n");
+            exit(1);
+        }
+    }
+
+    buf->pair[2 * buf->n]     = a;
+    buf->pair[2 * buf->n + 1] = b;
+    buf->n++;
+}
+
+// A minimal parallel-for: nThreads threads take work units 0 .. nUnits-1 from a shared
+// counter and call fn(arg, unit) for each of them.
+
+typedef void (*GraphWorkFn)(void *arg, int unit);
+
+typedef struct GraphWork
+{
+    GraphWorkFn fn;
+    void       *arg;
+    int         nUnits;
+    int         nextUnit;
+} GraphWork;
+
+int graphThreadCount(void)
+{
+    long n = (GRAPH_THREADS > 0) ? GRAPH_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+    return (n < 1) ? 1 : (int)n;
+}
+
+static void *graphWorker(void *p)
+{
+    GraphWork *work = p;
+    int unit;
+
+    while ((unit = __atomic_fetch_add(&work->nextUnit, 1, __ATOMIC_RELAXED)) < work->nUnits)
+        work->fn(work->arg, unit);
+
+    return NULL;
+}
+
+void parallelForUnits(int nUnits, GraphWorkFn fn, void *arg)
+{
+    GraphWork work = { fn, arg, nUnits, 0 };
+    int nThreads = graphThreadCount();
+    pthread_t threads[nThreads];
+    int t;
+
+    if (nThreads > nUnits)
+        nThreads = nUnits;
+
+    for (t = 1; t < nThreads; t++)
+        if (pthread_create(&threads[t], NULL, graphWorker, &work))
+        {
+            printf("COULD NOT START GRAPH GENERATOR THREAD\n");
+            exit(1);
+        }
+
+    graphWorker(&work); // the calling thread is worker 0
+
+    for (t = 1; t < nThreads; t++)
+        pthread_join(threads[t], NULL);
+}
+
+// State shared by the generator work units of one graph.
+typedef struct GraphGenerator
+{
+    int         type;     // Graph_type
+    int         nAgents;
+    uint64_t    seed;
+    int         nUnits;
+    int         nBlocks;     // blocks of GRAPH_BLOCK_AGENTS receivers used to build the CSR
+    EdgeBuffer *unitEdges;   // nUnits buffers of undirected edges
+    uint64_t   *bucketStart; // start of the edges of (block b, unit u) at [b * nUnits + u]
+    uint32_t   *rowLength;   // per-agent number of distinct senders
+} GraphGenerator;
+
+static inline int unitFirstAgent(int unit)
+{
+    return (int)((int64_t)unit * GRAPH_BLOCK_AGENTS);
+}
+
+static inline int unitEndAgent(GraphGenerator *gen, int unit)
+{
+    int64_t end = ((int64_t)unit + 1) * GRAPH_BLOCK_AGENTS;
+    return (int)((end < gen->nAgents) ? end : gen->nAgents);
+}
+
+// new far end of a rewired lattice edge of agent i: avoids self loops and, when the ring
+// is big enough, the lattice neighbors of i
+static inline uint32_t rewiredFarEnd(GraphRng *rng, uint32_t i, int n)
+{
+    uint32_t t;
+
+    do
+        t = graphRngInt(rng, n);
+    while (t == i || (n > 2 * NEIGHBORHOOD + 1 &&
+                      ((t + n - i) % n <= NEIGHBORHOOD || (i + n - t) % n <= NEIGHBORHOOD)));
+
+    return t;
+}
+
+// Watts-Strogatz: ring lattice in which agent i is joined to i+1 .. i+NEIGHBORHOOD, and
+// each lattice edge (i, i+j) has its far end moved to a uniformly chosen agent with
+// probability PROB_REWIRE.  Rewired edges are found by geometric skipping over the
+// lattice edges of the unit, k = (i - first) * NEIGHBORHOOD + (j - 1).
+void generateWattsStrogatzUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, gen->type, unit);
+    EdgeBuffer *buf = &gen->unitEdges[unit];
+    int n = gen->nAgents;
+    int first = unitFirstAgent(unit);
+    uint64_t nLattice = (uint64_t)(unitEndAgent(gen, unit) - first) * NEIGHBORHOOD;
+    uint64_t nextRewired = graphRngGeometric(&rng, PROB_REWIRE);
+
+    if (n < 2)
+        return;
+
+    for (uint64_t k = 0; k < nLattice; k++)
+    {
+        uint32_t i = first + (uint32_t)(k / NEIGHBORHOOD);
+        uint32_t t = (uint32_t)(((uint64_t)i + k % NEIGHBORHOOD + 1) % n);
+
+        if (k == nextRewired)
+        {
+            t = rewiredFarEnd(&rng, i, n);
+
+            uint64_t skip = graphRngGeometric(&rng, PROB_REWIRE);
+            nextRewired = (skip >= nLattice) ? nLattice : k + 1 + skip;
+        }
+
+        if (t != i)
+            addEdgeToBuffer(buf, i, t);
+    }
+}
+
+// Erdos-Renyi G(n,m) with m = MEAN_DEGREE * n / 2: unit u draws its share of the m
+// agent pairs uniformly.  Repeated pairs are merged when the CSR is built, which for
+// sparse graphs removes a negligible fraction of the edges.
+void generateGnmUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, gen->type, unit);
+    EdgeBuffer *buf = &gen->unitEdges[unit];
+    uint32_t n = gen->nAgents;
+    uint64_t m = (uint64_t)llround(MEAN_DEGREE * n / 2.0);
+    uint64_t perUnit = (m + gen->nUnits - 1) / gen->nUnits;
+    uint64_t first = (uint64_t)unit * perUnit;
+    uint64_t end = (first + perUnit < m) ? first + perUnit : m;
+
+    if (n < 2)
+        return;
+
+    for (uint64_t k = first; k < end; k++)
+    {
+        uint32_t a = graphRngInt(&rng, n);
+        uint32_t b = graphRngInt(&rng, n - 1);
+
+        addEdgeToBuffer(buf, a, (b >= a) ? b + 1 : b);
+    }
+}
+
+// Adds the pairs (i, v), lo <= v < hi, each with probability p, by geometric skipping.
+static void addBernoulliRange(EdgeBuffer *buf, GraphRng *rng, uint32_t i, uint64_t lo, uint64_t hi, double p)
+{
+    uint64_t v = lo;
+
+    while (v < hi)
+    {
+        uint64_t skip = graphRngGeometric(rng, p);
+
+        if (skip >= hi - v)
+            break;
+
+        v += skip;
+        addEdgeToBuffer(buf, i, (uint32_t)v);
+        v++;
+    }
+}
+
+// Erdos-Renyi G(n,p) with p = MEAN_DEGREE / (n - 1).  Each agent i of the unit is
+// paired with the agents after it.
+void generateGnpUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, gen->type, unit);
+    int n = gen->nAgents;
+    double p = (n > 1) ? MEAN_DEGREE / (n - 1) : 0.0;
+
+    for (int i = unitFirstAgent(unit); i < unitEndAgent(gen, unit); i++)
+        addBernoulliRange(&gen->unitEdges[unit], &rng, i, i + 1, n, p);
+}
+
+// Stochastic block model with SBM_N_BLOCKS equal blocks of consecutive agents.  Edge
+// probabilities inside and between blocks are chosen so that the expected degree is
+// MEAN_DEGREE with a fraction SBM_MIXING of it leaving the block.
+void generateStochasticBlockUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, gen->type, unit);
+    int n = gen->nAgents;
+    int blockSize = (n + SBM_N_BLOCKS - 1) / SBM_N_BLOCKS;
+    double pIn  = (blockSize > 1) ? MEAN_DEGREE * (1.0 - SBM_MIXING) / (blockSize - 1) : 0.0;
+    double pOut = (n > blockSize) ? MEAN_DEGREE * SBM_MIXING / (n - blockSize) : 0.0;
+
+    for (int i = unitFirstAgent(unit); i < unitEndAgent(gen, unit); i++)
+    {
+        int64_t blockEnd = ((int64_t)(i / blockSize) + 1) * blockSize;
+
+        if (blockEnd > n)
+            blockEnd = n;
+
+        addBernoulliRange(&gen->unitEdges[unit], &rng, i, i + 1, blockEnd, pIn);
+        addBernoulliRange(&gen->unitEdges[unit], &rng, i, blockEnd, n, pOut);
+    }
+}
+
+// Barabasi-Albert preferential attachment.  Each new agent joins BA_EDGES_PER_AGENT
+// distinct earlier agents chosen with probability proportional to their degree, by
+// sampling from the list of all edge endpoints so far.  The growth is inherently
+// sequential, so this generator is a single work unit; it is O(edges) and still builds
+// ten million agent graphs in a few seconds.  The first BA_EDGES_PER_AGENT + 1 agents
+// form a clique.
+void generateBarabasiAlbertUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, gen->type, unit);
+    EdgeBuffer *buf = &gen->unitEdges[unit];
+    int n = gen->nAgents;
+    int m = BA_EDGES_PER_AGENT;
+    int seedAgents = (m + 1 < n) ? m + 1 : n;
+    uint32_t chosen[m > 0 ? m : 1];
+
+    for (int a = 0; a < seedAgents; a++)
+        for (int b = a + 1; b < seedAgents; b++)
+            addEdgeToBuffer(buf, a, b);
+
+    for (int i = seedAgents; i < n; i++)
+    {
+        for (int k = 0; k < m; k++)
+        {
+            uint32_t t;
+            int repeated;
+
+            do
+            {
+                t = buf->pair[graphRngInt(&rng, 2 * buf->n)]; // uniform endpoint = degree-proportional agent
+                repeated = 0;
+                for (int j = 0; j < k; j++)
+                    repeated |= (chosen[j] == t);
+            } while (repeated);
+
+            chosen[k] = t;
+        }
+
+        for (int k = 0; k < m; k++)
+            addEdgeToBuffer(buf, i, chosen[k]);
+    }
+}
+
+// CSR construction from the unit edge buffers.  Every undirected edge {a, b} becomes the
+// two directed edges a <- b and b <- a (the equivalent of IGRAPH_TO_DIRECTED_MUTUAL).
+// The directed edges are first scattered into agentGraph.edge grouped by block of
+// receivers (block-major, then unit), which puts each block's edges exactly where its
+// CSR rows will be.  Each block then builds its rows in cache without atomics.  Rows are
+// sorted and repeated senders are dropped, so the result only depends on the seed.
+
+void countUnitBuckets(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    EdgeBuffer *buf = &gen->unitEdges[unit];
+    uint64_t *count = gen->bucketStart + 1;
+
+    for (size_t k = 0; k < 2 * buf->n; k++)
+        count[(size_t)(buf->pair[k] / GRAPH_BLOCK_AGENTS) * gen->nUnits + unit]++;
+}
+
+void scatterUnitBuckets(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    EdgeBuffer *buf = &gen->unitEdges[unit];
+    uint64_t cursor[gen->nBlocks];
+
+    for (int b = 0; b < gen->nBlocks; b++)
+        cursor[b] = gen->bucketStart[(size_t)b * gen->nUnits + unit];
+
+    for (size_t k = 0; k < buf->n; k++)
+    {
+        uint32_t a = buf->pair[2 * k], b = buf->pair[2 * k + 1];
+
+        agentGraph.edge[cursor[a / GRAPH_BLOCK_AGENTS]++] = packEdge(a, b);
+        agentGraph.edge[cursor[b / GRAPH_BLOCK_AGENTS]++] = packEdge(b, a);
+    }
+
+    free(buf->pair);
+    buf->pair = NULL;
+}
+
+static int compareAgentIds(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void buildBlockRows(void *arg, int block)
+{
+    GraphGenerator *gen = arg;
+    int first = unitFirstAgent(block), end = unitEndAgent(gen, block);
+    uint64_t start = gen->bucketStart[(size_t)block * gen->nUnits];
+    uint64_t stop  = gen->bucketStart[(size_t)(block + 1) * gen->nUnits];
+    uint32_t *offset = agentGraph.offset;
+    uint32_t cursor[end - first];
+    int r;
+
+    for (r = first; r < end; r++)
+        offset[r] = 0;
+
+    for (uint64_t k = start; k < stop; k++)
+        offset[edgeReceiver(agentGraph.edge[k])]++;
+
+    uint32_t position = (uint32_t)start;
+    for (r = first; r < end; r++)
+    {
+        uint32_t len = offset[r];
+        offset[r] = cursor[r - first] = position;
+        position += len;
+    }
+
+    for (uint64_t k = start; k < stop; k++)
+    {
+        uint64_t e = agentGraph.edge[k];
+        agentGraph.sender[cursor[edgeReceiver(e) - first]++] = edgeSender(e);
+    }
+
+    for (r = first; r < end; r++)
+    {
+        uint32_t *row = agentGraph.sender + offset[r];
+        uint32_t len = cursor[r - first] - offset[r];
+        uint32_t kept = 0;
+
+        if (len > 32)
+            qsort(row, len, sizeof(uint32_t), compareAgentIds);
+        else
+            for (uint32_t i = 1; i < len; i++) // insertion sort for the usual short rows
+            {
+                uint32_t v = row[i], j = i;
+                for (; j > 0 && row[j - 1] > v; j--)
+                    row[j] = row[j - 1];
+                row[j] = v;
+            }
+
+        for (uint32_t i = 0; i < len; i++)
+            if (kept == 0 || row[i] != row[kept - 1])
+                row[kept++] = row[i];
+
+        gen->rowLength[r] = kept;
+    }
+}
+
+void fillBlockEdges(void *arg, int block)
+{
+    GraphGenerator *gen = arg;
+
+    for (int r = unitFirstAgent(block); r < unitEndAgent(gen, block); r++)
+        for (uint32_t k = agentGraph.offset[r]; k < agentGraph.offset[r + 1]; k++)
+            agentGraph.edge[k] = packEdge(r, agentGraph.sender[k]);
+}
+
+// Generates a graph of the given native type directly into agentGraph.  The edge ids
+// follow the CSR order (by receiver, then sender).
+void generateNativeGraph(int type, uint64_t seed)
+{
+    GraphGenerator gen;
+    GraphWorkFn generateUnit;
+    int n = n_agents;
+
+    gen.type    = type;
+    gen.nAgents = n;
+    gen.seed    = seed;
+    gen.nBlocks = (int)(((int64_t)n + GRAPH_BLOCK_AGENTS - 1) / GRAPH_BLOCK_AGENTS);
+    gen.nUnits  = gen.nBlocks;
+
+    switch(type)
+    {
+        case WATTS_STROGATZ:    generateUnit = generateWattsStrogatzUnit;   break;
+        case ERDOS_RENYI_GNM:   generateUnit = generateGnmUnit;             break;
+        case ERDOS_RENYI_GNP:   generateUnit = generateGnpUnit;             break;
+        case STOCHASTIC_BLOCK:  generateUnit = generateStochasticBlockUnit; break;
+        case BARABASI_ALBERT:   generateUnit = generateBarabasiAlbertUnit;  gen.nUnits = 1; break;
+
+	default:
+	    printf("INVALID NATIVE GRAPH TYPE");
+	    exit(1);
+    }
+
+    gen.unitEdges = calloc(gen.nUnits, sizeof(EdgeBuffer));
+    parallelForUnits(gen.nUnits, generateUnit, &gen);
+
+    size_t nBuckets = (size_t)gen.nBlocks * gen.nUnits;
+    gen.bucketStart = calloc(nBuckets + 1, sizeof(uint64_t));
+    parallelForUnits(gen.nUnits, countUnitBuckets, &gen);
+
+    for (size_t k = 0; k < nBuckets; k++)
+        gen.bucketStart[k + 1] += gen.bucketStart[k];
+
+    uint64_t nDirected = gen.bucketStart[nBuckets];
+
+    if (nDirected > INT32_MAX)
+    {
+        printf("TOO MANY AGENT CONNECTIONS (%llu)\n", (unsigned long long)nDirected);
+        exit(1);
+    }
+
+    allocAgentGraph(n, (int)nDirected);
+
+    parallelForUnits(gen.nUnits, scatterUnitBuckets, &gen);
+    free(gen.unitEdges);
+
+    gen.rowLength = malloc((size_t)n * sizeof(uint32_t));
+    parallelForUnits(gen.nBlocks, buildBlockRows, &gen);
+    free(gen.bucketStart);
+
+    // close the gaps left by repeated senders (rows only move towards the front)
+    uint32_t kept = 0;
+    for (int r = 0; r < n; r++)
+    {
+        uint32_t start = agentGraph.offset[r];
+
+        memmove(agentGraph.sender + kept, agentGraph.sender + start, gen.rowLength[r] * sizeof(uint32_t));
+        agentGraph.offset[r] = kept;
+        kept += gen.rowLength[r];
+    }
+    agentGraph.offset[n] = kept;
+    agentGraph.nEdges = (int)kept;
+    free(gen.rowLength);
+
+    parallelForUnits(gen.nBlocks, fillBlockEdges, &gen);
+}
+
+// Implicit Watts-Strogatz graphs (IMPLICIT_WATTS_STROGATZ).  With a low PROB_REWIRE almost
+// every edge of a Watts-Strogatz graph is a lattice edge that can be computed, so instead of
+// an AgentGraph only the rewired lattice slots are stored.  Slot s = i * NEIGHBORHOOD + j - 1
+// is the undirected edge between agent i and its far end (i + j) % n, unless s is in the
+// sorted table rewiredSlot[], in which case its far end is rewiredTarget[].  The table is
+// drawn from the same random number streams as WATTS_STROGATZ, so both types give the same
+// edges, but numbered differently: edge id ac is slot ac / 2, received by i from the far end
+// when ac is even and by the far end from i when ac is odd.  The rewired slots of every
+// IMPLICIT_BUCKET_SLOTS consecutive slots are found through bucketStart[], so computing an
+// edge reads a couple of table entries.  This takes 12 bytes per rewired slot plus 4 bytes
+// per bucket, where an AgentGraph takes 12 bytes per directed edge.  A pair of agents joined by two slots is kept
+// twice (WATTS_STROGATZ keeps it once), which only happens to a handful of rewired edges.
+//
+// Only uniform edge sampling is supported: UNWEIGHTED, EDGE_UNIFORM, REWIRE_RATE 0 and
+// NATURAL_ORDER.  The connections are still written to connections_%d.txt when
+// STORE_AGENT_CONNECTIONS is set, but not to connections_%d.bin.
+
+#define IMPLICIT_BUCKET_SLOTS 16
+
+typedef struct ImplicitRing
+{
+    int       nAgents;
+    uint64_t  nSlots;        // nAgents * NEIGHBORHOOD
+    uint32_t *bucketStart;   // first table entry of each bucket of IMPLICIT_BUCKET_SLOTS slots
+    uint64_t *rewiredSlot;   // sorted
+    uint32_t *rewiredTarget;
+} ImplicitRing;
+
+ImplicitRing implicitRing;
+
+// the rewired slots of one unit, as (k, far end) pairs with k the slot within the unit, in
+// the same order and from the same draws as generateWattsStrogatzUnit
+void generateImplicitRingUnit(void *arg, int unit)
+{
+    GraphGenerator *gen = arg;
+    GraphRng rng = graphRngStream(gen->seed, WATTS_STROGATZ, unit);
+    int first = unitFirstAgent(unit);
+    uint64_t nLattice = (uint64_t)(unitEndAgent(gen, unit) - first) * NEIGHBORHOOD;
+    uint64_t k = graphRngGeometric(&rng, PROB_REWIRE);
+
+    while (k < nLattice)
+    {
+        uint32_t i = first + (uint32_t)(k / NEIGHBORHOOD);
+
+        addEdgeToBuffer(&gen->unitEdges[unit], (uint32_t)k, rewiredFarEnd(&rng, i, gen->nAgents));
+
+        uint64_t skip = graphRngGeometric(&rng, PROB_REWIRE);
+        k = (skip >= nLattice) ? nLattice : k + 1 + skip;
+    }
+}
+
+void generateImplicitRing(uint64_t seed)
+{
+    GraphGenerator gen;
+    int n = n_agents;
+
+    if (n <= NEIGHBORHOOD || 2 * (uint64_t)n * NEIGHBORHOOD > INT32_MAX)
+    {
+        printf("INVALID NUMBER OF AGENTS FOR IMPLICIT_WATTS_STROGATZ (%d)\n", n);
+        exit(1);
+    }
+
+    memset(&gen, 0, sizeof(gen));
+    gen.type    = IMPLICIT_WATTS_STROGATZ;
+    gen.nAgents = n;
+    gen.seed    = seed;
+    gen.nBlocks = (int)(((int64_t)n + GRAPH_BLOCK_AGENTS - 1) / GRAPH_BLOCK_AGENTS);
+    gen.nUnits  = gen.nBlocks;
+
+    gen.unitEdges = calloc(gen.nUnits, sizeof(EdgeBuffer));
+    parallelForUnits(gen.nUnits, generateImplicitRingUnit, &gen);
+
+    uint64_t nRewired = 0;
+    uint64_t nBuckets = ((uint64_t)n * NEIGHBORHOOD + IMPLICIT_BUCKET_SLOTS - 1) / IMPLICIT_BUCKET_SLOTS;
+
+    for (int u = 0; u < gen.nUnits; u++)
+        nRewired += gen.unitEdges[u].n;
+
+    implicitRing.nAgents       = n;
+    implicitRing.nSlots        = (uint64_t)n * NEIGHBORHOOD;
+    implicitRing.bucketStart   = calloc(nBuckets + 1, sizeof(uint32_t));
+    implicitRing.rewiredSlot   = malloc((nRewired ? nRewired : 1) * sizeof(uint64_t));
+    implicitRing.rewiredTarget = malloc((nRewired ? nRewired : 1) * sizeof(uint32_t));
+
+    if (!implicitRing.bucketStart || !implicitRing.rewiredSlot || !implicitRing.rewiredTarget)
+    {
+        printf("OUT OF MEMORY FOR IMPLICIT_WATTS_STROGATZ (%llu rewired edges)\n", (unsigned long long)nRewired);
+        exit(1);
+    }
+
+    // the units are in agent order, so the table comes out sorted
+    uint64_t r = 0;
+
+    for (int u = 0; u < gen.nUnits; u++)
+    {
+        EdgeBuffer *buf = &gen.unitEdges[u];
+        uint64_t unitSlot = (uint64_t)unitFirstAgent(u) * NEIGHBORHOOD;
+
+        for (size_t k = 0; k < buf->n; k++, r++)
+        {
+            implicitRing.rewiredSlot[r]   = unitSlot + buf->pair[2 * k];
+            implicitRing.rewiredTarget[r] = buf->pair[2 * k + 1];
+            implicitRing.bucketStart[implicitRing.rewiredSlot[r] / IMPLICIT_BUCKET_SLOTS + 1]++;
+        }
+
+        free(buf->pair);
+    }
+
+    free(gen.unitEdges);
+
+    for (uint64_t b = 0; b < nBuckets; b++)
+        implicitRing.bucketStart[b + 1] += implicitRing.bucketStart[b];
+
+    agentGraph.nAgents = n; // no edges are stored
+    printf("%llu of %llu lattice edges rewired\n", (unsigned long long)nRewired,
+           (unsigned long long)implicitRing.nSlots);
+}
+
+void freeImplicitRing(void)
+{
+    free(implicitRing.bucketStart);
+    free(implicitRing.rewiredSlot);
+    free(implicitRing.rewiredTarget);
+    memset(&implicitRing, 0, sizeof(implicitRing));
+}
+
+static inline uint64_t implicitEdge(int ac)
+{
+    uint64_t slot = (uint64_t)ac >> 1;
+    uint32_t i = (uint32_t)(slot / NEIGHBORHOOD);
+    uint32_t t = (uint32_t)(((uint64_t)i + slot % NEIGHBORHOOD + 1) % implicitRing.nAgents);
+    uint64_t bucket = slot / IMPLICIT_BUCKET_SLOTS;
+
+    for (uint32_t k = implicitRing.bucketStart[bucket]; k < implicitRing.bucketStart[bucket + 1]; k++)
+        if (implicitRing.rewiredSlot[k] == slot)
+        {
+            t = implicitRing.rewiredTarget[k];
+            break;
+        }
+
+    return (ac & 1) ? packEdge(t, i) : packEdge(i, t);
+}
+
+uint64_t connectionEdge(int ac)
+{
+    return (graphType == IMPLICIT_WATTS_STROGATZ) ? implicitEdge(ac) : agentGraph.edge[ac];
+}
+
+#ifdef USE_IGRAPH
+igraph_t graph;
+
+void initIgraphConnections(uint64_t seed)
+{
+    igraph_rng_seed(igraph_rng_default(), (unsigned long)seed); // igraph uses a separate random number generator
+
+    // The actions depending on the type of igraph are contained within this switch statement.
+    // This switch statement sets up the type of graph selected above.
+    switch(graphType)
+    {
+        case IGRAPH_WATTS_STROGATZ:
+        {
+            int error1 = igraph_watts_strogatz_game(&graph, 1, n_agents, NEIGHBORHOOD, PROB_REWIRE, 0, 0);
+            int error2 = igraph_to_directed(&graph, IGRAPH_TO_DIRECTED_MUTUAL); // creates bi-directional graph
+
+            if (error1 || error2)
+	        exit(1);
+
+	    break;
+        }
+
+        case IGRAPH_ERDOS_RENYI:
+        {
+            igraph_erdos_renyi_t graphSubtype = IGRAPH_ERDOS_RENYI_GNM;
+            igraph_real_t p_or_m = round(0.05 * n_agents * n_agents);
+
+            int error1 = igraph_erdos_renyi_game(&graph, graphSubtype, n_agents, p_or_m, 0, 0);
+            int error2 = igraph_to_directed(&graph, IGRAPH_TO_DIRECTED_MUTUAL); // creates bi-directional graph
+
+            if (error1 || error2)
+	        exit(1);
+
+	    break;
+        }
+
+	default:
+	    printf("INVALID IGRAPH TYPE");
+	    exit(1);
+    }
+
+    // The following code is executed for any type of igraph:
+    // copy the edges into agentGraph and release the igraph object.
+
+    allocAgentGraph(n_agents, (int)igraph_ecount(&graph));
+
+    for (igraph_integer_t ac = 0; (int)ac < agentGraph.nEdges; ac++) // ac = each edge id
+    {
+        igraph_integer_t sender, receiver;
+        igraph_edge(&graph, ac, &sender, &receiver);
+        agentGraph.edge[ac] = packEdge((uint32_t)receiver, (uint32_t)sender);
+    }
+
+    igraph_destroy(&graph);
+
+    buildAgentGraphIndex();
+}
+#endif
+
+typedef struct AgentLink
+{
+	int receiver;
+	int sender;
+} AgentLink;
+
+AgentLink agentConnections[] = { {0,2}, {1,0}, {2,1} };
+
+void initFixedAgentConnections(void)
+{
+    int nEdges = sizeof(agentConnections) / sizeof(agentConnections[0]);
+
+    allocAgentGraph(n_agents, nEdges);
+
+    for (int ac = 0; ac < nEdges; ac++)
+        agentGraph.edge[ac] = packEdge(agentConnections[ac].receiver, agentConnections[ac].sender);
+
+    buildAgentGraphIndex();
+}
+
+// seed of the native graph generators for a run
+uint64_t graphSeed(int runNum)
+{
+    uint64_t state = (SEED < 0) ? (uint64_t)time(NULL) : (uint64_t)SEED;
+
+    state ^= (uint64_t)runNum * 0x9E3779B97F4A7C15ULL;
+    return splitmix64(&state);
+}
+
+double wallSeconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+// Edge weights (tie strength).  With UNWEIGHTED every directed edge is sampled with equal
+// probability.  With STATIC_WEIGHTS the weights are fixed for the run and edges are sampled
+// from a Walker alias table in O(1).  With DYNAMIC_WEIGHTS the weight of an edge grows by
+// WEIGHT_REINFORCEMENT each time it carries social input, and edges are sampled from a
+// Fenwick tree of the weights in O(log numberAgentConnections).
+//
+// Weights are either generated (symmetric, so a <- b and b <- a have the same tie strength)
+// or read from EDGE_WEIGHT_FILE, one "<receiver> <sender> <weight>" line per edge;
+// edges that are not listed keep weight 1.
+
+typedef enum {UNWEIGHTED, STATIC_WEIGHTS, DYNAMIC_WEIGHTS} Weight_mode;
+typedef enum {WEIGHTS_UNIFORM, WEIGHTS_LOGNORMAL, WEIGHTS_FROM_FILE} Weight_source;
+
+Weight_mode weightMode = UNWEIGHTED;
+Weight_source weightSource = WEIGHTS_LOGNORMAL;
+
+typedef struct EdgeSampler
+{
+    float    *prob;   // alias table: keep edge k with probability prob[k] ...
+    uint32_t *alias;  // ... otherwise take edge alias[k]
+    double   *tree;   // Fenwick tree of the weights, entries 1 .. nEdges
+    double    total;  // sum of the weights in tree
+    int       topBit; // largest power of 2 <= nEdges
+} EdgeSampler;
+
+EdgeSampler edgeSampler;
+
+const char *weightModeName(Weight_mode mode)
+{
+    switch(mode)
+    {
+        case UNWEIGHTED:      return "UNWEIGHTED";
+        case STATIC_WEIGHTS:  return "STATIC_WEIGHTS";
+        case DYNAMIC_WEIGHTS: return "DYNAMIC_WEIGHTS";
+    }
+    return "UNKNOWN";
+}
+
+const char *weightSourceName(Weight_source source)
+{
+    switch(source)
+    {
+        case WEIGHTS_UNIFORM:   return "WEIGHTS_UNIFORM";
+        case WEIGHTS_LOGNORMAL: return "WEIGHTS_LOGNORMAL";
+        case WEIGHTS_FROM_FILE: return "WEIGHTS_FROM_FILE";
+    }
+    return "UNKNOWN";
+}
+
+// weight of the tie between agents a and b, drawn from a stream of the unordered pair
+float generatedTieStrength(uint64_t seed, uint32_t a, uint32_t b)
+{
+    uint32_t lo = (a < b) ? a : b, hi = (a < b) ? b : a;
+    GraphRng rng = graphRngStream(seed, WEIGHT_STREAM, ((uint64_t)hi << 32) | lo);
+
+    if (weightSource == WEIGHTS_UNIFORM)
+        return (float)(1.0 - graphRngReal(&rng)); // in (0, 1]
+
+    // Box-Muller normal deviate for a lognormal weight with median 1
+    double u1 = 1.0 - graphRngReal(&rng), u2 = graphRngReal(&rng);
+    return (float)exp(WEIGHT_LOGNORMAL_SIGMA * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+static int compareEdgeIds(const void *a, const void *b)
+{
+    uint64_t x = agentGraph.edge[*(const uint32_t *)a], y = agentGraph.edge[*(const uint32_t *)b];
+    return (x > y) - (x < y);
+}
+
+void loadEdgeWeights(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    uint32_t *byPair = malloc((size_t)agentGraph.nEdges * sizeof(uint32_t)); // edge ids sorted by (receiver, sender)
+    unsigned receiver, sender;
+    float w;
+    int nRead = 0, nMissing = 0;
+
+    if (!fp || !byPair)
+    {
+        printf("COULD NOT READ EDGE WEIGHTS FROM %s\n", filename);
+        exit(1);
+    }
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+    {
+        byPair[ac] = ac;
+        agentGraph.weight[ac] = 1.0f;
+    }
+
+    qsort(byPair, agentGraph.nEdges, sizeof(uint32_t), compareEdgeIds);
+
+    while (fscanf(fp, "%u %u %f", &receiver, &sender, &w) == 3)
+    {
+        uint64_t key = packEdge(receiver, sender);
+        int lo = 0, hi = agentGraph.nEdges;
+
+        while (lo < hi) // first edge id with a (receiver, sender) pair >= key
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (agentGraph.edge[byPair[mid]] < key) lo = mid + 1; else hi = mid;
+        }
+
+        if (lo == agentGraph.nEdges || agentGraph.edge[byPair[lo]] != key)
+        {
+            nMissing++;
+            continue;
+        }
+
+        for (; lo < agentGraph.nEdges && agentGraph.edge[byPair[lo]] == key; lo++)
+            agentGraph.weight[byPair[lo]] = w;
+        nRead++;
+    }
+
+    fclose(fp);
+    free(byPair);
+
+    printf("read %d edge weights from %s (%d lines did not match an edge)\n", nRead, filename, nMissing);
+}
+
+void initEdgeWeights(uint64_t seed)
+{
+    if (weightMode == UNWEIGHTED)
+    {
+        if (!agentGraph.mapping) // weights that came with a graph file are not used
+            free(agentGraph.weight);
+        agentGraph.weight = NULL;
+        return;
+    }
+
+    if (agentGraph.weight) // weights that came with a graph file take precedence
+        return;
+
+    agentGraph.weight = malloc((size_t)agentGraph.nEdges * sizeof(float));
+
+    if (weightSource == WEIGHTS_FROM_FILE)
+        loadEdgeWeights(EDGE_WEIGHT_FILE);
+    else
+        for (int ac = 0; ac < agentGraph.nEdges; ac++)
+        {
+            uint64_t e = agentGraph.edge[ac];
+            agentGraph.weight[ac] = generatedTieStrength(seed, edgeReceiver(e), edgeSender(e));
+        }
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+        if (!(agentGraph.weight[ac] >= 0.0f))
+        {
+            printf("INVALID WEIGHT %f FOR EDGE %d\n", agentGraph.weight[ac], ac);
+            exit(1);
+        }
+}
+
+// Vose's construction of the alias table for the current weights, O(nEdges).
+void buildAliasTable(void)
+{
+    int m = agentGraph.nEdges;
+    double total = 0.0;
+    double *scaled = malloc((size_t)m * sizeof(double));
+    uint32_t *small = malloc((size_t)m * sizeof(uint32_t));
+    uint32_t *large = malloc((size_t)m * sizeof(uint32_t));
+    int nSmall = 0, nLarge = 0;
+
+    edgeSampler.prob  = malloc((size_t)m * sizeof(float));
+    edgeSampler.alias = malloc((size_t)m * sizeof(uint32_t));
+
+    for (int k = 0; k < m; k++)
+        total += agentGraph.weight[k];
+
+    if (total <= 0.0)
+    {
+        printf("ALL EDGE WEIGHTS ARE ZERO\n");
+        exit(1);
+    }
+
+    for (int k = 0; k < m; k++)
+    {
+        scaled[k] = agentGraph.weight[k] * m / total;
+        if (scaled[k] < 1.0) small[nSmall++] = k; else large[nLarge++] = k;
+    }
+
+    while (nSmall > 0 && nLarge > 0)
+    {
+        uint32_t s = small[--nSmall], l = large[nLarge - 1];
+
+        edgeSampler.prob[s]  = (float)scaled[s];
+        edgeSampler.alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+
+        if (scaled[l] < 1.0)
+        {
+            nLarge--;
+            small[nSmall++] = l;
+        }
+    }
+
+    // whatever is left is 1 up to rounding
+    while (nLarge > 0) { uint32_t k = large[--nLarge]; edgeSampler.prob[k] = 1.0f; edgeSampler.alias[k] = k; }
+    while (nSmall > 0) { uint32_t k = small[--nSmall]; edgeSampler.prob[k] = 1.0f; edgeSampler.alias[k] = k; }
+
+    free(scaled);
+    free(small);
+    free(large);
+}
+
+void buildWeightTree(void)
+{
+    int m = agentGraph.nEdges;
+    double *tree = calloc((size_t)m + 1, sizeof(double));
+
+    for (int i = 1; i <= m; i++)
+    {
+        tree[i] += agentGraph.weight[i - 1];
+        int parent = i + (i & -i);
+        if (parent <= m)
+            tree[parent] += tree[i];
+    }
+
+    edgeSampler.tree = tree;
+    edgeSampler.total = 0.0;
+    for (int i = m; i > 0; i -= i & -i)
+        edgeSampler.total += tree[i];
+
+    for (edgeSampler.topBit = 1; 2 * edgeSampler.topBit <= m; edgeSampler.topBit *= 2)
+        ;
+}
+
+void initEdgeSampler(void)
+{
+    memset(&edgeSampler, 0, sizeof(edgeSampler));
+
+    if (weightMode == STATIC_WEIGHTS)
+        buildAliasTable();
+    else if (weightMode == DYNAMIC_WEIGHTS)
+        buildWeightTree();
+}
+
+void freeEdgeSampler(void)
+{
+    free(edgeSampler.prob);
+    free(edgeSampler.alias);
+    free(edgeSampler.tree);
+    memset(&edgeSampler, 0, sizeof(edgeSampler));
+}
+
+// edge id with probability proportional to its weight; one random number per call
+int sampleWeightedEdge(void)
+{
+    int m = agentGraph.nEdges;
+
+    if (weightMode == STATIC_WEIGHTS)
+    {
+        double u = drand48() * m;
+        int k = (int)u;
+
+        return (u - k < edgeSampler.prob[k]) ? k : (int)edgeSampler.alias[k];
+    }
+
+    // descend the Fenwick tree to the first edge whose cumulative weight exceeds target
+    double target = drand48() * edgeSampler.total;
+    int pos = 0;
+
+    for (int step = edgeSampler.topBit; step > 0; step /= 2)
+        if (pos + step <= m && edgeSampler.tree[pos + step] <= target)
+        {
+            pos += step;
+            target -= edgeSampler.tree[pos];
+        }
+
+    return (pos < m) ? pos : m - 1;
+}
+
+// DYNAMIC_WEIGHTS: adds delta to the weight of edge ac, O(log numberAgentConnections)
+void addToEdgeWeight(int ac, double delta)
+{
+    agentGraph.weight[ac] += (float)delta;
+    edgeSampler.total += delta;
+
+    for (int i = ac + 1; i <= agentGraph.nEdges; i += i & -i)
+        edgeSampler.tree[i] += delta;
+}
+
+// Sampling modes of chooseRandomConnection.
+//
+//   EDGE_UNIFORM    a uniformly distributed (or weighted) edge, which selects agents in
+//                   proportion to their degree;
+//   RECEIVER_FIRST  a uniformly distributed agent as receiver, then one of its senders;
+//   SENDER_FIRST    a uniformly distributed agent as sender, then one of its receivers.
+//
+// Both agent-first modes draw a single random number u in [0, nAgents): its integer part
+// selects the agent from a precomputed list and its fractional part selects the neighbor
+// from the agent's row, so they cost the same as EDGE_UNIFORM.  Agents without a neighbor in
+// the required direction are handled by zeroDegreePolicy rather than by drawing again:
+//
+//   ZERO_DEGREE_EXCLUDED       they are left out of the list, so they are never selected;
+//   ZERO_DEGREE_USE_PROTOTYPE  they are selected as often as any other agent, and are trained
+//                              on a distortion of their prototype (sender is -1).
+//
+// Receivers come from the CSR.  Senders use a SenderIndex of out-neighbor rows in a pool,
+// which rewiring keeps up to date: a row that has to grow is moved to the end of the pool.
+// Weighted sampling applies to EDGE_UNIFORM only.
+
+typedef enum {EDGE_UNIFORM, RECEIVER_FIRST, SENDER_FIRST} Sampling_mode;
+typedef enum {ZERO_DEGREE_EXCLUDED, ZERO_DEGREE_USE_PROTOTYPE} Zero_degree_policy;
+
+Sampling_mode samplingMode = EDGE_UNIFORM;
+Zero_degree_policy zeroDegreePolicy = ZERO_DEGREE_EXCLUDED;
+
+typedef struct SenderIndex
+{
+    uint32_t *start;      // first slot of each agent's receivers in pool
+    uint32_t *degree;     // out-degree of each agent
+    uint32_t *capacity;   // slots reserved for each agent in pool
+    uint32_t *pool;
+    size_t    poolSize;
+    size_t    poolCapacity;
+} SenderIndex;
+
+// agents that can be selected first, with their positions so the list can change in O(1)
+typedef struct AgentList
+{
+    uint32_t *agent;
+    uint32_t *position; // index of each agent in agent[], or UINT32_MAX
+    int       n;
+} AgentList;
+
+SenderIndex senderIndex;
+AgentList   firstAgents;
+
+const char *samplingModeName(Sampling_mode mode)
+{
+    switch(mode)
+    {
+        case EDGE_UNIFORM:   return "EDGE_UNIFORM";
+        case RECEIVER_FIRST: return "RECEIVER_FIRST";
+        case SENDER_FIRST:   return "SENDER_FIRST";
+    }
+    return "UNKNOWN";
+}
+
+const char *zeroDegreePolicyName(Zero_degree_policy policy)
+{
+    switch(policy)
+    {
+        case ZERO_DEGREE_EXCLUDED:      return "ZERO_DEGREE_EXCLUDED";
+        case ZERO_DEGREE_USE_PROTOTYPE: return "ZERO_DEGREE_USE_PROTOTYPE";
+    }
+    return "UNKNOWN";
+}
+
+static inline uint32_t firstAgentDegree(uint32_t a)
+{
+    if (samplingMode == RECEIVER_FIRST)
+        return agentGraph.offset[a + 1] - agentGraph.offset[a];
+    else
+        return senderIndex.degree[a];
+}
+
+static void addFirstAgent(uint32_t a)
+{
+    firstAgents.position[a] = firstAgents.n;
+    firstAgents.agent[firstAgents.n++] = a;
+}
+
+static void removeFirstAgent(uint32_t a)
+{
+    uint32_t p = firstAgents.position[a];
+    uint32_t last = firstAgents.agent[--firstAgents.n];
+
+    firstAgents.agent[p] = last;
+    firstAgents.position[last] = p;
+    firstAgents.position[a] = UINT32_MAX;
+}
+
+void buildSenderIndex(void)
+{
+    int n = agentGraph.nAgents;
+
+    senderIndex.start    = malloc((size_t)n * sizeof(uint32_t));
+    senderIndex.degree   = calloc((size_t)n, sizeof(uint32_t));
+    senderIndex.capacity = malloc((size_t)n * sizeof(uint32_t));
+    senderIndex.poolSize = senderIndex.poolCapacity = agentGraph.nEdges;
+    senderIndex.pool     = malloc((senderIndex.poolCapacity + 1) * sizeof(uint32_t));
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+        senderIndex.degree[edgeSender(agentGraph.edge[ac])]++;
+
+    uint32_t slot = 0;
+    for (int a = 0; a < n; a++)
+    {
+        senderIndex.start[a] = slot;
+        senderIndex.capacity[a] = senderIndex.degree[a];
+        slot += senderIndex.degree[a];
+        senderIndex.degree[a] = 0;
+    }
+
+    for (int r = 0; r < n; r++) // receivers in increasing order within each row
+        for (uint32_t k = agentGraph.offset[r]; k < agentGraph.offset[r + 1]; k++)
+        {
+            uint32_t s = agentGraph.sender[k];
+            senderIndex.pool[senderIndex.start[s] + senderIndex.degree[s]++] = r;
+        }
+}
+
+void addSenderIndexEdge(uint32_t sender, uint32_t receiver)
+{
+    if (senderIndex.degree[sender] == senderIndex.capacity[sender])
+    {
+        uint32_t capacity = 2 * senderIndex.capacity[sender] + 4;
+
+        if (senderIndex.poolSize + capacity > senderIndex.poolCapacity)
+        {
+            senderIndex.poolCapacity = 2 * (senderIndex.poolSize + capacity);
+            senderIndex.pool = realloc(senderIndex.pool, senderIndex.poolCapacity * sizeof(uint32_t));
+        }
+
+        memcpy(senderIndex.pool + senderIndex.poolSize, senderIndex.pool + senderIndex.start[sender],
+               senderIndex.degree[sender] * sizeof(uint32_t));
+        senderIndex.start[sender] = (uint32_t)senderIndex.poolSize;
+        senderIndex.capacity[sender] = capacity;
+        senderIndex.poolSize += capacity;
+    }
+
+    senderIndex.pool[senderIndex.start[sender] + senderIndex.degree[sender]++] = receiver;
+
+    if (senderIndex.degree[sender] == 1 && zeroDegreePolicy == ZERO_DEGREE_EXCLUDED)
+        addFirstAgent(sender);
+}
+
+void removeSenderIndexEdge(uint32_t sender, uint32_t receiver)
+{
+    uint32_t *row = senderIndex.pool + senderIndex.start[sender];
+
+    for (uint32_t k = 0; k < senderIndex.degree[sender]; k++)
+        if (row[k] == receiver)
+        {
+            row[k] = row[--senderIndex.degree[sender]];
+            break;
+        }
+
+    if (senderIndex.degree[sender] == 0 && zeroDegreePolicy == ZERO_DEGREE_EXCLUDED)
+        removeFirstAgent(sender);
+}
+
+void initAgentSampling(void)
+{
+    int n = agentGraph.nAgents;
+
+    memset(&senderIndex, 0, sizeof(senderIndex));
+    memset(&firstAgents, 0, sizeof(firstAgents));
+
+    if (samplingMode == EDGE_UNIFORM)
+        return;
+
+    if (weightMode != UNWEIGHTED)
+    {
+        printf("WEIGHTED SAMPLING REQUIRES SAMPLING MODE EDGE_UNIFORM\n");
+        exit(1);
+    }
+
+    if (samplingMode == SENDER_FIRST)
+        buildSenderIndex();
+
+    firstAgents.agent    = malloc((size_t)n * sizeof(uint32_t));
+    firstAgents.position = malloc((size_t)n * sizeof(uint32_t));
+
+    for (int a = 0; a < n; a++)
+    {
+        firstAgents.position[a] = UINT32_MAX;
+        if (zeroDegreePolicy == ZERO_DEGREE_USE_PROTOTYPE || firstAgentDegree(a) > 0)
+            addFirstAgent(a);
+    }
+
+    if (firstAgents.n == 0)
+    {
+        printf("NO AGENT HAS A CONNECTION FOR SAMPLING MODE %s\n", samplingModeName(samplingMode));
+        exit(1);
+    }
+}
+
+void freeAgentSampling(void)
+{
+    free(senderIndex.start);
+    free(senderIndex.degree);
+    free(senderIndex.capacity);
+    free(senderIndex.pool);
+    free(firstAgents.agent);
+    free(firstAgents.position);
+    memset(&senderIndex, 0, sizeof(senderIndex));
+    memset(&firstAgents, 0, sizeof(firstAgents));
+}
+
+// RECEIVER_FIRST and SENDER_FIRST; the other agent is -1 when the first one has no neighbor
+void chooseAgentFirst(int *pReceiver, int *pSender)
+{
+    double u = drand48() * firstAgents.n;
+    int i = (int)u;
+    uint32_t a = firstAgents.agent[i];
+    uint32_t degree = firstAgentDegree(a);
+    int other = -1;
+
+    if (degree > 0)
+    {
+        uint32_t k = (uint32_t)((u - i) * degree); // fractional part picks the neighbor
+
+        if (k >= degree)
+            k = degree - 1;
+
+        if (samplingMode == RECEIVER_FIRST)
+            other = (int)agentGraph.sender[agentGraph.offset[a] + k];
+        else
+            other = (int)senderIndex.pool[senderIndex.start[a] + k];
+    }
+
+    if (samplingMode == RECEIVER_FIRST || other < 0)
+    {
+        *pReceiver = (int)a;  // an agent without neighbors is trained on its prototype
+        *pSender   = other;
+    }
+    else
+    {
+        *pReceiver = other;
+        *pSender   = (int)a;
+    }
+}
+
+// Cache of generated graphs.  A generated graph depends only on the graph type, n_agents,
+// the generator parameters, GRAPH_BLOCK_AGENTS (which splits the random streams), the
+// generators themselves and the seed of the run, so runs of parameter combinations that
+// differ in anything else (n_features, social_prob_parameter, ...) can share it.  The key is
+// the text of those values, with GRAPH_GENERATOR_VERSION for the generators; its hash names
+// the cache file, and the key itself is stored in the file and must match for a hit.  Graphs
+// are kept in memory (the GRAPH_CACHE_MEMORY_ENTRIES most recently used, copied on a hit
+// since a run may rewire its graph) and as binary graph files in GRAPH_CACHE_DIR (mapped on
+// a hit).  Weights are not cached; they are regenerated, which is cheap.  Nothing is cached
+// when SEED is negative.
+
+#define GRAPH_CACHE_KEY_SIZE 512
+
+typedef struct CachedGraph
+{
+    char       key[GRAPH_CACHE_KEY_SIZE];
+    long       lastUse;
+    AgentGraph graph;
+} CachedGraph;
+
+CachedGraph graphCache[GRAPH_CACHE_MEMORY_ENTRIES > 0 ? GRAPH_CACHE_MEMORY_ENTRIES : 1];
+long graphCacheUses;
+char graphCacheDir[1024];  // absolute, since runs change directory
+int  graphCacheMemoryHits, graphCacheDiskHits, graphCacheMisses;
+
+typedef enum {GRAPH_GENERATED, GRAPH_FROM_MEMORY_CACHE, GRAPH_FROM_DISK_CACHE} Graph_origin;
+Graph_origin graphOrigin;
+
+int graphIsCacheable(Graph_type type)
+{
+    // an implicit graph is generated faster than it could be read back
+    return SEED >= 0 && type != FIXED_AGENT_CONNECTIONS && type != GRAPH_FROM_FILE && type != IMPLICIT_WATTS_STROGATZ;
+}
+
+// writes the key of the graph of a run to key (GRAPH_CACHE_KEY_SIZE bytes)
+void graphCacheKey(Graph_type type, int runNum, char *key)
+{
+    snprintf(key, GRAPH_CACHE_KEY_SIZE, "%s generators=%d file=%d block=%d n=%d nei=%d rewire=%.17g degree=%.17g "
+             "ba=%d sbm=%d,%.17g seed=%llu", graphTypeName(type), GRAPH_GENERATOR_VERSION, GRAPH_FILE_VERSION,
+             GRAPH_BLOCK_AGENTS, n_agents, NEIGHBORHOOD, PROB_REWIRE, MEAN_DEGREE, BA_EDGES_PER_AGENT,
+             SBM_N_BLOCKS, SBM_MIXING, (unsigned long long)graphSeed(runNum));
+}
+
+uint64_t graphCacheHash(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+
+    for (const char *c = key; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+
+    return hash;
+}
+
+void initGraphCache(void)
+{
+    const char *dir = GRAPH_CACHE_DIR;
+
+    if (dir[0] == '\0')
+        return;
+
+    if (dir[0] == '/')
+        snprintf(graphCacheDir, sizeof(graphCacheDir), "%s", dir);
+    else
+    {
+        char *cwd = getcwd(NULL, 0);
+        snprintf(graphCacheDir, sizeof(graphCacheDir), "%s/%s", cwd, dir);
+        free(cwd);
+    }
+
+    mkdir(graphCacheDir, 0777);
+}
+
+// copy of the topology of a graph (without weights) in newly allocated arrays
+AgentGraph duplicateAgentGraph(const AgentGraph *from)
+{
+    AgentGraph to;
+
+    memset(&to, 0, sizeof(to));
+    to.nAgents = from->nAgents;
+    to.nEdges  = from->nEdges;
+    to.edge    = malloc((size_t)from->nEdges * sizeof(uint64_t));
+    to.offset  = malloc((size_t)(from->nAgents + 1) * sizeof(uint32_t));
+    to.sender  = malloc((size_t)from->nEdges * sizeof(uint32_t));
+
+    if (!to.edge || !to.offset || !to.sender)
+    {
+        printf("OUT OF MEMORY FOR AGENT GRAPH (%d agents, %d edges)\n", from->nAgents, from->nEdges);
+        exit(1);
+    }
+
+    memcpy(to.edge,   from->edge,   (size_t)from->nEdges * sizeof(uint64_t));
+    memcpy(to.offset, from->offset, (size_t)(from->nAgents + 1) * sizeof(uint32_t));
+    memcpy(to.sender, from->sender, (size_t)from->nEdges * sizeof(uint32_t));
+    return to;
+}
+
+void graphCacheFileName(char *filename, size_t size, const char *key)
+{
+    snprintf(filename, size, "%s/graph_%016llx.bin", graphCacheDir, (unsigned long long)graphCacheHash(key));
+}
+
+// Fills agentGraph from the cache if possible; returns 1 on a hit.
+int findCachedGraph(const char *key)
+{
+    for (int k = 0; k < GRAPH_CACHE_MEMORY_ENTRIES; k++)
+        if (graphCache[k].graph.edge && strcmp(graphCache[k].key, key) == 0)
+        {
+            graphCache[k].lastUse = ++graphCacheUses;
+            agentGraph = duplicateAgentGraph(&graphCache[k].graph);
+            graphCacheMemoryHits++;
+            graphOrigin = GRAPH_FROM_MEMORY_CACHE;
+            return 1;
+        }
+
+    if (graphCacheDir[0])
+    {
+        char filename[1200];
+
+        graphCacheFileName(filename, sizeof(filename), key);
+
+        if (mapAgentGraph(filename, key) == 0)
+        {
+            graphCacheDiskHits++;
+            graphOrigin = GRAPH_FROM_DISK_CACHE;
+            return 1;
+        }
+    }
+
+    graphCacheMisses++;
+    return 0;
+}
+
+// Stores the newly generated agentGraph (before weights are added) under key.
+void storeCachedGraph(const char *key)
+{
+    if (GRAPH_CACHE_MEMORY_ENTRIES > 0)
+    {
+        int slot = 0;
+
+        for (int k = 1; k < GRAPH_CACHE_MEMORY_ENTRIES; k++) // an empty slot or the least recently used
+            if (graphCache[slot].graph.edge && (!graphCache[k].graph.edge || graphCache[k].lastUse < graphCache[slot].lastUse))
+                slot = k;
+
+        releaseAgentGraph(&graphCache[slot].graph);
+        graphCache[slot].graph = duplicateAgentGraph(&agentGraph);
+        snprintf(graphCache[slot].key, GRAPH_CACHE_KEY_SIZE, "%s", key);
+        graphCache[slot].lastUse = ++graphCacheUses;
+    }
+
+    if (graphCacheDir[0])
+    {
+        char filename[1200];
+
+        graphCacheFileName(filename, sizeof(filename), key);
+
+        if (saveAgentGraph(filename, key, graphCacheHash(key)) != 0)
+            printf("COULD NOT WRITE GRAPH CACHE FILE %s\n", filename);
+    }
+}
+
+const char *graphOriginName(Graph_origin origin)
+{
+    switch(origin)
+    {
+        case GRAPH_GENERATED:         return "generated";
+        case GRAPH_FROM_MEMORY_CACHE: return "memory cache";
+        case GRAPH_FROM_DISK_CACHE:   return "disk cache";
+    }
+    return "unknown";
+}
+
+// Renumbering of agents for locality.  The generators number agents in an order that has
+// nothing to do with the graph (igraph, Erdos-Renyi, or Watts-Strogatz once rewired), so the
+// nets, outputs and prototypes of an agent's neighbors are scattered in memory.  With an
+// agentOrder other than NATURAL_ORDER, the agents are permuted after the graph is built:
+//
+//   BFS_ORDER        breadth-first order, each component from its lowest numbered agent;
+//   RCM_ORDER        reverse Cuthill-McKee: breadth-first from a minimum degree agent of each
+//                    component, neighbors in increasing degree, then the order is reversed;
+//   COMMUNITY_ORDER  communities found by COMMUNITY_ROUNDS sweeps of label propagation, laid
+//                    out one after another, breadth-first order within each community.
+//
+// The graph is treated as undirected for ordering.  Inside the program every agent number is
+// an internal one; extId() gives the original number, which is what every output file uses
+// (history, prototypes, connections and rewiring logs), and pretraining still goes through
+// the agents in their original order.  Edge ids are not changed, so edge weights and uniform
+// edge sampling are not affected.  Only the topology is cached, before renumbering.
+
+typedef enum {NATURAL_ORDER, BFS_ORDER, RCM_ORDER, COMMUNITY_ORDER} Agent_order;
+
+Agent_order agentOrder = NATURAL_ORDER;
+
+uint32_t *agentExtIds;  // original number of each internal agent, NULL for NATURAL_ORDER
+uint32_t *agentIntIds;  // internal number of each original agent
+
+const char *agentOrderName(Agent_order order)
+{
+    switch(order)
+    {
+        case NATURAL_ORDER:   return "NATURAL_ORDER";
+        case BFS_ORDER:       return "BFS_ORDER";
+        case RCM_ORDER:       return "RCM_ORDER";
+        case COMMUNITY_ORDER: return "COMMUNITY_ORDER";
+    }
+    return "UNKNOWN";
+}
+
+static inline int extId(int a)
+{
+    return (agentExtIds && a >= 0) ? (int)agentExtIds[a] : a;
+}
+
+static inline int intId(int a)
+{
+    return agentIntIds ? (int)agentIntIds[a] : a;
+}
+
+// symmetric adjacency (CSR) of agentGraph, used only to compute an order
+typedef struct Neighbors
+{
+    uint32_t *offset;
+    uint32_t *agent;
+} Neighbors;
+
+static Neighbors buildNeighbors(void)
+{
+    Neighbors nb;
+    int n = agentGraph.nAgents;
+
+    nb.offset = calloc((size_t)n + 1, sizeof(uint32_t));
+    nb.agent  = malloc(2 * (size_t)agentGraph.nEdges * sizeof(uint32_t));
+
+    if (!nb.offset || !nb.agent)
+    {
+        printf("OUT OF MEMORY FOR AGENT ORDER (%d agents, %d edges)\n", n, agentGraph.nEdges);
+        exit(1);
+    }
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+    {
+        nb.offset[edgeReceiver(agentGraph.edge[ac]) + 1]++;
+        nb.offset[edgeSender(agentGraph.edge[ac]) + 1]++;
+    }
+
+    for (int a = 0; a < n; a++)
+        nb.offset[a + 1] += nb.offset[a];
+
+    uint32_t *next = malloc((size_t)n * sizeof(uint32_t));
+    memcpy(next, nb.offset, (size_t)n * sizeof(uint32_t));
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+    {
+        uint32_t r = edgeReceiver(agentGraph.edge[ac]), s = edgeSender(agentGraph.edge[ac]);
+
+        nb.agent[next[r]++] = s;
+        nb.agent[next[s]++] = r;
+    }
+
+    free(next);
+    return nb;
+}
+
+static inline uint32_t neighborDegree(const Neighbors *nb, uint32_t a)
+{
+    return nb->offset[a + 1] - nb->offset[a];
+}
+
+static const Neighbors *sortNeighbors; // for compareByDegree
+
+static int compareByDegree(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    uint32_t dx = neighborDegree(sortNeighbors, x), dy = neighborDegree(sortNeighbors, y);
+
+    if (dx != dy)
+        return (dx < dy) ? -1 : 1;
+    return (x < y) ? -1 : (x > y);
+}
+
+// Appends to order[] the agents reached breadth-first from start that are not yet placed and,
+// when community is given, are in the same community as start.  Returns the new length.
+static int breadthFirst(const Neighbors *nb, uint32_t start, uint8_t *placed, const uint32_t *community,
+                        int byDegree, uint32_t *order, int length)
+{
+    int head = length;
+
+    order[length++] = start;
+    placed[start] = 1;
+
+    while (head < length)
+    {
+        uint32_t a = order[head++];
+        int first = length;
+
+        for (uint32_t k = nb->offset[a]; k < nb->offset[a + 1]; k++)
+        {
+            uint32_t b = nb->agent[k];
+
+            if (placed[b] || (community && community[b] != community[start]))
+                continue;
+
+            placed[b] = 1;
+            order[length++] = b;
+        }
+
+        if (byDegree)
+        {
+            sortNeighbors = nb;
+            qsort(order + first, length - first, sizeof(uint32_t), compareByDegree);
+        }
+    }
+
+    return length;
+}
+
+// label propagation: every agent takes the most frequent label among its neighbors
+// (smallest label on ties), sweeping the agents in order COMMUNITY_ROUNDS times
+static uint32_t *findCommunities(const Neighbors *nb)
+{
+    int n = agentGraph.nAgents;
+    uint32_t *label = malloc((size_t)n * sizeof(uint32_t));
+    uint32_t *count = calloc((size_t)n, sizeof(uint32_t));
+    uint32_t *seen  = malloc((size_t)n * sizeof(uint32_t));
+
+    for (int a = 0; a < n; a++)
+        label[a] = a;
+
+    for (int round = 0; round < COMMUNITY_ROUNDS; round++)
+    {
+        int changed = 0;
+
+        for (int a = 0; a < n; a++)
+        {
+            int nSeen = 0;
+            uint32_t best = label[a], bestCount = 0;
+
+            for (uint32_t k = nb->offset[a]; k < nb->offset[a + 1]; k++)
+            {
+                uint32_t l = label[nb->agent[k]];
+
+                if (count[l]++ == 0)
+                    seen[nSeen++] = l;
+
+                if (count[l] > bestCount || (count[l] == bestCount && l < best))
+                {
+                    best = l;
+                    bestCount = count[l];
+                }
+            }
+
+            for (int k = 0; k < nSeen; k++)
+                count[seen[k]] = 0;
+
+            if (bestCount > 0 && best != label[a])
+            {
+                label[a] = best;
+                changed = 1;
+            }
+        }
+
+        if (!changed)
+            break;
+    }
+
+    free(count);
+    free(seen);
+    return label;
+}
+
+// mean |a - b| over edges a <- b, a measure of how far apart neighbors are in memory
+static double meanNeighborGap(void)
+{
+    double sum = 0.0;
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+        sum += abs((int)edgeReceiver(agentGraph.edge[ac]) - (int)edgeSender(agentGraph.edge[ac]));
+
+    return agentGraph.nEdges ? sum / agentGraph.nEdges : 0.0;
+}
+
+static void permuteRows(real **rows, const uint32_t *extIds, int n)
+{
+    real *copy = malloc((size_t)n * n_features * sizeof(real));
+
+    for (int a = 0; a < n; a++)
+        memcpy(copy + (size_t)a * n_features, rows[a], n_features * sizeof(real));
+
+    for (int a = 0; a < n; a++)
+        memcpy(rows[a], copy + (size_t)extIds[a] * n_features, n_features * sizeof(real));
+
+    free(copy);
+}
+
+// Computes the order given by agentOrder and renumbers agentGraph and the prototypes.
+void renumberAgents(void)
+{
+    int n = agentGraph.nAgents;
+    int length = 0;
+
+    if (agentOrder == NATURAL_ORDER)
+        return;
+
+    double start = wallSeconds();
+    double gapBefore = meanNeighborGap();
+    Neighbors nb = buildNeighbors();
+    uint8_t *placed = calloc((size_t)n, 1);
+    uint32_t *order = malloc((size_t)n * sizeof(uint32_t));
+    uint32_t *community = NULL;
+
+    switch(agentOrder)
+    {
+        case BFS_ORDER:
+            for (int a = 0; a < n; a++)
+                if (!placed[a])
+                    length = breadthFirst(&nb, a, placed, NULL, 0, order, length);
+            break;
+
+        case RCM_ORDER:
+        {
+            uint32_t *byDegree = malloc((size_t)n * sizeof(uint32_t));
+
+            for (int a = 0; a < n; a++)
+                byDegree[a] = a;
+
+            sortNeighbors = &nb;
+            qsort(byDegree, n, sizeof(uint32_t), compareByDegree);
+
+            for (int k = 0; k < n; k++)
+                if (!placed[byDegree[k]])
+                    length = breadthFirst(&nb, byDegree[k], placed, NULL, 1, order, length);
+
+            for (int k = 0; k < n / 2; k++)
+            {
+                uint32_t t = order[k];
+
+                order[k] = order[n - 1 - k];
+                order[n - 1 - k] = t;
+            }
+
+            free(byDegree);
+            break;
+        }
+
+        case COMMUNITY_ORDER:
+        {
+            // agents grouped by community (labels are agent numbers), so that a community
+            // that is not connected by itself is still laid out in one piece
+            uint32_t *first = calloc((size_t)n + 1, sizeof(uint32_t));
+            uint32_t *byCommunity = malloc((size_t)n * sizeof(uint32_t));
+
+            community = findCommunities(&nb);
+
+            for (int a = 0; a < n; a++)
+                first[community[a] + 1]++;
+            for (int l = 0; l < n; l++)
+                first[l + 1] += first[l];
+            for (int a = 0; a < n; a++)
+                byCommunity[first[community[a]]++] = a;
+
+            for (int k = 0; k < n; k++)
+                if (!placed[byCommunity[k]])
+                    length = breadthFirst(&nb, byCommunity[k], placed, community, 0, order, length);
+
+            free(first);
+            free(byCommunity);
+            break;
+        }
+
+	default:
+	    printf("INVALID AGENT ORDER");
+	    exit(1);
+    }
+
+    agentExtIds = order;
+    agentIntIds = malloc((size_t)n * sizeof(uint32_t));
+
+    for (int a = 0; a < n; a++)
+        agentIntIds[order[a]] = a;
+
+    for (int ac = 0; ac < agentGraph.nEdges; ac++)
+    {
+        uint64_t e = agentGraph.edge[ac];
+
+        agentGraph.edge[ac] = packEdge(agentIntIds[edgeReceiver(e)], agentIntIds[edgeSender(e)]);
+    }
+
+    buildAgentGraphIndex();
+    permuteRows(prototype, agentExtIds, n);
+
+    printf("%s: mean neighbor gap %.1f -> %.1f (%.3f seconds)\n", agentOrderName(agentOrder),
+           gapBefore, meanNeighborGap(), wallSeconds() - start);
+
+    free(nb.offset);
+    free(nb.agent);
+    free(placed);
+    free(community);
+}
+
+void freeAgentOrder(void)
+{
+    free(agentExtIds);
+    free(agentIntIds);
+    agentExtIds = agentIntIds = NULL;
+}
+
+void generateAgentConnections(int runNum)
+{
+    switch(graphType)
+    {
+        case WATTS_STROGATZ:
+        case ERDOS_RENYI_GNM:
+        case ERDOS_RENYI_GNP:
+        case BARABASI_ALBERT:
+        case STOCHASTIC_BLOCK:
+            generateNativeGraph(graphType, graphSeed(runNum));
+            break;
+
+        case IMPLICIT_WATTS_STROGATZ:
+            generateImplicitRing(graphSeed(runNum));
+            break;
+
+#ifdef USE_IGRAPH
+        case IGRAPH_WATTS_STROGATZ:
+        case IGRAPH_ERDOS_RENYI:
+            initIgraphConnections(graphSeed(runNum));
+            break;
+#endif
+
+        case FIXED_AGENT_CONNECTIONS:
+            initFixedAgentConnections();
+            break;
+
+        case GRAPH_FROM_FILE:
+            loadAgentGraph(runNum);
+            break;
+
+	default:
+	    printf("INVALID GRAPH TYPE");
+	    exit(1);
+    }
+}
+
+void initAgentConnections(int runNum)
+{
+    double start = wallSeconds();
+    int cacheable = graphIsCacheable(graphType);
+    char key[GRAPH_CACHE_KEY_SIZE];
+
+    if (cacheable)
+        graphCacheKey(graphType, runNum, key);
+
+    graphOrigin = GRAPH_GENERATED;
+
+    if (!cacheable || !findCachedGraph(key))
+    {
+        generateAgentConnections(runNum);
+
+        if (cacheable)
+            storeCachedGraph(key);
+    }
+
+    printf("%s graph of %d agents (%s) ready in %.3f seconds\n", graphTypeName(graphType), n_agents,
+           graphOriginName(graphOrigin), wallSeconds() - start);
+
+    if (graphType == IMPLICIT_WATTS_STROGATZ &&
+        (weightMode != UNWEIGHTED || samplingMode != EDGE_UNIFORM || REWIRE_RATE > 0.0 || agentOrder != NATURAL_ORDER))
+    {
+        printf("IMPLICIT_WATTS_STROGATZ REQUIRES UNWEIGHTED EDGE_UNIFORM SAMPLING, NO REWIRING AND NATURAL_ORDER\n");
+        exit(1);
+    }
+
+    initEdgeWeights(graphSeed(runNum));
+
+    if (graphType == IMPLICIT_WATTS_STROGATZ)
+        finishAgentConnections(runNum, (int)(2 * implicitRing.nSlots));
+    else
+        finishAgentConnections(runNum, agentGraph.nEdges);
+
+    renumberAgents();
+    initEdgeSampler();
+    initAgentSampling();
+}
+
+// Returns the edge id of the chosen connection, or -1 in the agent-first modes.
+// *pSender is -1 when the receiver has no sender (see zeroDegreePolicy).
+int chooseRandomConnection(int *pReceiver, int *pSender)
+{
+    int ac;
+
+    if (samplingMode != EDGE_UNIFORM)
+    {
+        chooseAgentFirst(pReceiver, pSender);
+        return -1;
+    }
+
+    if (weightMode == UNWEIGHTED)
+        ac = rand_int(numberAgentConnections); // random# from 0 thru numberAgentConnections - 1
+    else
+        ac = sampleWeightedEdge();
+
+    uint64_t e = connectionEdge(ac);
+
+    *pReceiver = (int)edgeReceiver(e);
+    *pSender   = (int)edgeSender(e);
+    return ac;
+}
+
+// How the weight blocks of the agents are stored (WEIGHT_TEMPLATES), see the agent networks.
+
+typedef enum {WEIGHTS_FULL, WEIGHTS_BFLOAT16, WEIGHTS_FLOAT16} Weight_storage;
+
+Weight_storage weightStorage = WEIGHTS_FULL;
+
+const char *weightStorageName(Weight_storage storage)
+{
+    switch(storage)
+    {
+        case WEIGHTS_FULL:     return "WEIGHTS_FULL";
+        case WEIGHTS_BFLOAT16: return "WEIGHTS_BFLOAT16";
+        case WEIGHTS_FLOAT16:  return "WEIGHTS_FLOAT16";
+    }
+    return "UNKNOWN";
+}
+
+// Checkpoints.  With CHECKPOINT_EVERY_K_TICKS, the complete state of a run is written to
+// checkpoint_%d.bin after every K ticks: prototypes, outputs, the weights and weight changes
+// (momentum) of every agent's network, the graph as rewired so far with its edge weights and
+// sampling state, the drand48 and rewiring random states, the metrics, and how far the
+// history, rewiring and metrics files have got.  It is written to checkpoint_%d.tmp and
+// renamed, so there is always one complete checkpoint.  When a run ends, its checkpoint is
+// replaced by one holding only the random state, marked complete.
+//
+// "social -restart" resumes from the checkpoints in the current directory: completed runs
+// are skipped (their random state is restored, so later runs draw the same numbers), and a
+// run with a checkpoint is set up again from the random state it started with, which
+// regenerates the same prototypes and graph, then has the state of the checkpoint put back
+// and goes on from the next tick.  Its output files are truncated to where they were at the
+// checkpoint, so the history is the same as that of a run that was never interrupted.  The
+// graph seed must not depend on the time (SEED >= 0).  Checkpoints are in the layout of the
+// machine and build that wrote them.
+
+#define CHECKPOINT_MAGIC "CMCHKPT1"
+
+typedef struct CheckpointHeader
+{
+    char     magic[8];          // CHECKPOINT_MAGIC
+    uint32_t headerSize;        // sizeof(CheckpointHeader)
+    int32_t  runNum;
+    int32_t  complete;          // the run finished; nothing else is restored
+    int32_t  tick;              // last tick done
+    int32_t  nAgents;
+    int32_t  nFeatures;
+    int32_t  nHidden;
+    int32_t  nEdges;            // of agentGraph, 0 for the implicit graph
+    uint32_t nLinks;            // in each agent's network
+    int32_t  nFirstAgents;      // RECEIVER_FIRST and SENDER_FIRST
+    int32_t  currentAgent;      // WEIGHT_TEMPLATES: agent whose weights are in the network, -1 if none
+    int32_t  currentTrained;    // and whether it was trained since they were loaded
+    unsigned short randStart[3]; // drand48 state when the run started
+    unsigned short randState[3]; // drand48 state after tick
+    uint64_t rewireRng;
+    int64_t  historyOffset;     // bytes of the output files at tick
+    int64_t  rewireOffset;
+    int64_t  metricsOffset;
+    int64_t  historyRows;
+    uint64_t historyRecords;
+    uint64_t historyBlocks;     // HISTORY_COMPRESSED: entries of the block index
+    int64_t  rewireEvents;
+    double   edgeWeightTotal;   // DYNAMIC_WEIGHTS
+    double   metricsSumSquares;
+} CheckpointHeader;
+
+int restartFromCheckpoints;  // set by -restart
+int resuming;                // the current run goes on from resumeFrom
+CheckpointHeader resumeFrom;
+unsigned short runRandStart[3]; // drand48 state when the current run started
+
+// drand48's state, which seed48 returns when it replaces it
+void getRandState(unsigned short state[3])
+{
+    unsigned short probe[3] = { 0, 0, 0 };
+
+    memcpy(state, seed48(probe), 3 * sizeof(unsigned short));
+    seed48(state);
+}
+
+// opens an output file of an interrupted run, without what was written after the checkpoint
+FILE *reopenOutput(const char *filename, int64_t offset)
+{
+    FILE *fp = fopen(filename, "r+b");
+
+    if (!fp || ftruncate(fileno(fp), (off_t)offset) != 0 || fseeko(fp, (off_t)offset, SEEK_SET) != 0)
+    {
+        printf("COULD NOT RESUME %s AT %lld BYTES\n", filename, (long long)offset);
+        exit(1);
+    }
+    return fp;
+}
+
+
+// Rewiring of the graph during a run.  Each tick, REWIRE_RATE rewiring events are made on
+// average (a rate above 1 gives several events per tick).  An event picks a uniformly
+// distributed edge r <- s and moves its sender end to a new agent s':
+//
+//   REWIRE_RANDOM     the edge is always moved, s' is a uniformly chosen agent;
+//   REWIRE_HOMOPHILY  the edge is moved with probability equal to the mean absolute
+//                     difference of the outputs of r and s, and s' is the agent most similar
+//                     to r among REWIRE_CANDIDATES uniformly chosen agents.
+//
+// s' is never r or an agent r already receives from.  Only the sender end moves, so every
+// receiver keeps its number of senders: the edge keeps its id and weight, the CSR row of r is
+// updated in place, and the alias table or weight tree stay valid without being rebuilt.
+// Rewiring draws from its own random number stream, so the rest of the run consumes
+// the same random numbers as without it.  Rows of the CSR are no longer sorted once rewired.
+//
+// Every event is appended to rewiring_%d.bin as a RewireEvent record after a RewireFileHeader.
+
+typedef enum {REWIRE_RANDOM, REWIRE_HOMOPHILY} Rewire_rule;
+
+Rewire_rule rewireRule = REWIRE_HOMOPHILY;
+
+typedef struct RewireFileHeader
+{
+    char     magic[8];    // "CMREWIRE"
+    uint32_t recordSize;  // sizeof(RewireEvent)
+    uint32_t nAgents;
+} RewireFileHeader;
+
+typedef struct RewireEvent
+{
+    int32_t  tick;
+    uint32_t receiver;
+    uint32_t oldSender;
+    uint32_t newSender;
+} RewireEvent;
+
+GraphRng rewireRng;
+FILE *rewireFile;
+long  nRewireEvents;
+
+const char *rewireRuleName(Rewire_rule rule)
+{
+    switch(rule)
+    {
+        case REWIRE_RANDOM:    return "REWIRE_RANDOM";
+        case REWIRE_HOMOPHILY: return "REWIRE_HOMOPHILY";
+    }
+    return "UNKNOWN";
+}
+
+void initRewiring(int runNum)
+{
+    char filename[40];
+    RewireFileHeader header = { {'C','M','R','E','W','I','R','E'}, sizeof(RewireEvent), (uint32_t)n_agents };
+
+    nRewireEvents = 0;
+
+    if (REWIRE_RATE <= 0.0)
+        return;
+
+    rewireRng = graphRngStream(graphSeed(runNum), REWIRE_STREAM, 0);
+
+    sprintf(filename, "rewiring_%d.bin", runNum);
+
+    if (resuming)
+    {
+        rewireRng.state = resumeFrom.rewireRng;
+        nRewireEvents = resumeFrom.rewireEvents;
+        rewireFile = reopenOutput(filename, resumeFrom.rewireOffset);
+        return;
+    }
+
+    rewireFile = fopen(filename, "wb");
+    fwrite(&header, sizeof(header), 1, rewireFile);
+}
+
+void concludeRewiring(void)
+{
+    if (!rewireFile)
+        return;
+
+    fclose(rewireFile);
+    rewireFile = NULL;
+    printf("%ld rewiring events\n", nRewireEvents);
+}
+
+// mean absolute difference of the outputs of agents a and b, 0 (same) to 1
+real outputDistance(int a, int b)
+{
+    real d = 0.0;
+
+    for (int i = 0; i < n_features; i++)
+        d += fabs(outputs[a][i] - outputs[b][i]);
+
+    return d / n_features;
+}
+
+static int receivesFrom(uint32_t receiver, uint32_t sender)
+{
+    for (uint32_t k = agentGraph.offset[receiver]; k < agentGraph.offset[receiver + 1]; k++)
+        if (agentGraph.sender[k] == sender)
+            return 1;
+
+    return 0;
+}
+
+void rewireOneConnection(int tick)
+{
+    int ac = graphRngInt(&rewireRng, numberAgentConnections);
+    uint32_t receiver = edgeReceiver(agentGraph.edge[ac]);
+    uint32_t oldSender = edgeSender(agentGraph.edge[ac]);
+    uint32_t newSender = receiver;
+    real bestDistance = 2.0;
+
+    if (rewireRule == REWIRE_HOMOPHILY && graphRngReal(&rewireRng) >= outputDistance(receiver, oldSender))
+        return;
+
+    for (int c = 0; c < ((rewireRule == REWIRE_HOMOPHILY) ? REWIRE_CANDIDATES : 1); c++)
+    {
+        uint32_t candidate = intId(graphRngInt(&rewireRng, n_agents));
+
+        if (candidate == receiver || receivesFrom(receiver, candidate))
+            continue;
+
+        real d = (rewireRule == REWIRE_HOMOPHILY) ? outputDistance(receiver, candidate) : 0.0;
+
+        if (d < bestDistance)
+        {
+            bestDistance = d;
+            newSender = candidate;
+        }
+    }
+
+    if (newSender == receiver) // no admissible candidate this time
+        return;
+
+    agentGraph.edge[ac] = packEdge(receiver, newSender);
+
+    if (samplingMode == SENDER_FIRST)
+    {
+        removeSenderIndexEdge(oldSender, receiver);
+        addSenderIndexEdge(newSender, receiver);
+    }
+
+    for (uint32_t k = agentGraph.offset[receiver]; k < agentGraph.offset[receiver + 1]; k++)
+        if (agentGraph.sender[k] == oldSender)
+        {
+            agentGraph.sender[k] = newSender;
+            break;
+        }
+
+    RewireEvent event = { tick, extId(receiver), extId(oldSender), extId(newSender) };
+    fwrite(&event, sizeof(event), 1, rewireFile);
+    nRewireEvents++;
+}
+
+void rewireConnections(int tick)
+{
+    if (REWIRE_RATE <= 0.0)
+        return;
+
+    int nEvents = (int)REWIRE_RATE;
+
+    if (graphRngReal(&rewireRng) < REWIRE_RATE - nEvents)
+        nEvents++;
+
+    for (int k = 0; k < nEvents; k++)
+        rewireOneConnection(tick);
+}
+
+real rand_real() // uniform;ly dist 0.0 to 1.0
+{
+    return drand48(); // drand48 is supposed to produce a better random number than rand()
+//	return (real)rand() / (real)RAND_MAX;
+}
+
+real rand_real_a_to_b(real a, real b) // uniformly dist real between a and b
+{
+	return (b - a) * rand_real() + a;
+}
+
+int rand_int(int max)  // random int from 0 to max-1
+{
+    return floor((real)max * drand48());
+}
+
+
+int oneWithProb(real p)
+{
+	return (rand_real() < p) ? 1 : 0;
+}
+
+
+// History output.  Each row of the history goes through writeHistoryRow, which either
+// prints it to history_%d.txt as before (HISTORY_TEXT) or adds a fixed width record to
+// history_%d.bin (HISTORY_BINARY, see history.h).  Binary records are collected in a buffer
+// of HISTORY_BUFFER_BYTES and written a block at a time, with the parameters of the run in
+// the file header.  historyconv regenerates history_%d.txt from history_%d.bin.  With
+// HISTORY_NONE no history is written, for sweeps that only need metrics_%d.txt.
+//
+// With HISTORY_WRITER_THREAD, a full block is handed to a writer thread and the simulation
+// goes on filling the next of HISTORY_BUFFERS blocks, used in a ring: blocks head ..
+// head + nFull - 1 wait for the writer, and block head + nFull is being filled.  The lock is
+// only taken once per block.  When all the blocks are full the simulation waits for the
+// writer (backpressure), so memory use is bounded; closeHistory hands over the last block
+// and waits for the writer to finish.  The time the writer spends writing and the time the
+// simulation spends waiting for it are printed at the end of each run.
+//
+// HISTORY_COMPRESSED writes the same records as HISTORY_BINARY, but every block is encoded
+// as described in history.h and compressed by the writer thread, so compression does not
+// slow the simulation down unless the writer falls behind.
+//
+// With HISTORY_QUANTIZE_BITS 8 or 16 the binary formats store every input and output as a
+// fixed point number, round(x * (2^bits - 1)), instead of a real (see history.h).  Outputs
+// are sigmoid values in (0, 1) and so are the social inputs copied from them; the error is
+// at most 0.5 / (2^bits - 1), that is 0.00196 with 8 bits and 0.0000076 with 16 bits, while
+// the text format rounds to 0.0000005.  Binary prototype inputs are stored exactly.  Values
+// outside [0, 1] are clipped.
+//
+// historyPolicy decides which ticks are recorded: all of them (HISTORY_ALL_TICKS), every
+// HISTORY_EVERY_N_TICKS-th (HISTORY_EVERY_NTH_TICK), or those whose receiver or social
+// sender is one of HISTORY_AGENTS (HISTORY_AGENT_SUBSET).  A recorded tick has a row for the
+// receiver only or for every agent, depending on OMIT_ROWS_FOR_AGENTS_NOT_UPDATED.  Every
+// SNAPSHOT_EVERY_K_TICKS ticks a row is written for every agent whatever the policy, so the
+// state of the whole population can be followed in a long run without a row per tick.
+// Rows after pretraining are always written.  The policy is in the parameters of each run.
+
+typedef enum {HISTORY_TEXT, HISTORY_BINARY, HISTORY_COMPRESSED, HISTORY_NONE} History_format;
+
+History_format historyFormat = HISTORY_BINARY;
+
+typedef enum {HISTORY_ALL_TICKS, HISTORY_EVERY_NTH_TICK, HISTORY_AGENT_SUBSET} History_policy;
+
+History_policy historyPolicy = HISTORY_ALL_TICKS;
+
+typedef enum {NO_ROWS, RECEIVER_ROW, ALL_ROWS} History_rows;
+
+typedef struct HistoryWriter
+{
+    FILE   *fp;
+    char   *buffer;   // HISTORY_BINARY: block being filled
+    size_t  used;
+    size_t  capacity;
+    size_t  recordSize;
+    size_t  inputsOffset;
+    size_t  valueSize;  // bytes per stored input or output
+    real    valueScale; // HISTORY_QUANTIZE_BITS: stored value of 1.0
+    long    nRows;
+
+    char   *block[HISTORY_BUFFERS];
+    size_t  blockUsed[HISTORY_BUFFERS];
+    int     head;      // next block for the writer
+    int     nFull;     // blocks waiting for the writer
+    int     done;      // no more blocks will come
+    int     threaded;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+
+    double  writeSeconds; // in fwrite (and compression)
+    double  waitSeconds;  // simulation waiting for a free block
+    double  bytes;
+    double  rawBytes;     // before compression
+
+    // HISTORY_COMPRESSED, used by whichever thread writes the blocks
+    char     *columns;      // the columns of a block before shuffling
+    char     *shuffled;     // after shuffling
+    unsigned char *compressed;
+    size_t    columnsCapacity;
+    uLongf    compressedCapacity;
+    uint32_t *lastRecord;   // per agent, 1 + its last record in the block if lastStamp is the block's
+    uint32_t *lastStamp;
+    uint32_t  stamp;
+    HistoryIndexEntry *index;
+    size_t    nBlocks;
+    uint64_t  nRecords;
+
+    uint8_t  *agentSelected; // HISTORY_AGENT_SUBSET: per internal agent
+} HistoryWriter;
+
+HistoryWriter history;
+
+const char *historyFormatName(History_format format)
+{
+    switch(format)
+    {
+        case HISTORY_TEXT:   return "HISTORY_TEXT";
+        case HISTORY_BINARY: return "HISTORY_BINARY";
+        case HISTORY_COMPRESSED: return "HISTORY_COMPRESSED";
+        case HISTORY_NONE:   return "HISTORY_NONE";
+    }
+    return "UNKNOWN";
+}
+
+const char *historyPolicyName(History_policy policy)
+{
+    switch(policy)
+    {
+        case HISTORY_ALL_TICKS:      return "HISTORY_ALL_TICKS";
+        case HISTORY_EVERY_NTH_TICK: return "HISTORY_EVERY_NTH_TICK";
+        case HISTORY_AGENT_SUBSET:   return "HISTORY_AGENT_SUBSET";
+    }
+    return "UNKNOWN";
+}
+
+void writeParameters(FILE *fp, int runNum);
+void initHistoryCompression(size_t blockRecords);
+static void *historyWriterThread(void *arg);
+
+// marks the agents of HISTORY_AGENTS, a comma separated list of original agent numbers and
+// ranges first-last
+void selectHistoryAgents(void)
+{
+    const char *p = HISTORY_AGENTS;
+
+    history.agentSelected = calloc(n_agents, 1);
+
+    if (!history.agentSelected)
+    {
+        printf("NOT ENOUGH MEMORY FOR HISTORY AGENTS\n");
+        exit(1);
+    }
+
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p)
+        {
+            printf("INVALID HISTORY_AGENTS %s\n", HISTORY_AGENTS);
+            exit(1);
+        }
+
+        p = end;
+
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+
+            if (end == p + 1)
+            {
+                printf("INVALID HISTORY_AGENTS %s\n", HISTORY_AGENTS);
+                exit(1);
+            }
+
+            p = end;
+        }
+
+        if (first < 0 || last >= n_agents || first > last)
+        {
+            printf("HISTORY_AGENTS %s OUT OF RANGE FOR %d AGENTS\n", HISTORY_AGENTS, n_agents);
+            exit(1);
+        }
+
+        for (long ext = first; ext <= last; ext++)
+            history.agentSelected[intId(ext)] = 1;
+
+        while (*p == ',' || *p == ' ')
+            p++;
+    }
+}
+
+// which rows of tick are written; sender is -1 when the receiver's input was not social
+History_rows historyRowsAtTick(int tick, int receiver, int sender)
+{
+    if (historyFormat == HISTORY_NONE)
+        return NO_ROWS;
+
+    if (SNAPSHOT_EVERY_K_TICKS > 0 && tick % SNAPSHOT_EVERY_K_TICKS == 0)
+        return ALL_ROWS;
+
+    switch(historyPolicy)
+    {
+        case HISTORY_ALL_TICKS:
+            break;
+
+        case HISTORY_EVERY_NTH_TICK:
+            if (tick % HISTORY_EVERY_N_TICKS != 0)
+                return NO_ROWS;
+            break;
+
+        case HISTORY_AGENT_SUBSET:
+            if (!history.agentSelected[receiver] && (sender < 0 || !history.agentSelected[sender]))
+                return NO_ROWS;
+            break;
+    }
+
+    return OMIT_ROWS_FOR_AGENTS_NOT_UPDATED ? RECEIVER_ROW : ALL_ROWS;
+}
+
+void openHistory(int runNum)
+{
+    char filename[40];
+
+    memset(&history, 0, sizeof(history));
+
+    if (historyFormat == HISTORY_NONE)
+        return;
+
+    if (historyPolicy == HISTORY_EVERY_NTH_TICK && HISTORY_EVERY_N_TICKS < 1)
+    {
+        printf("INVALID HISTORY_EVERY_N_TICKS %d\n", HISTORY_EVERY_N_TICKS);
+        exit(1);
+    }
+
+    if (historyPolicy == HISTORY_AGENT_SUBSET)
+        selectHistoryAgents();
+
+    if (historyFormat == HISTORY_TEXT)
+    {
+        sprintf(filename, "history_%d.txt", runNum);
+        history.fp = resuming ? reopenOutput(filename, resumeFrom.historyOffset) : fopen(filename, "w");
+
+        if (history.fp && !resuming)
+            fprintf(history.fp, "<tick#> <agent#> <1 if receiving agent> <sending agent#> <%d inputs> <%d outputs>\n\n", n_features, n_features);
+    }
+    else
+    {
+        if (HISTORY_QUANTIZE_BITS != 0 && HISTORY_QUANTIZE_BITS != 8 && HISTORY_QUANTIZE_BITS != 16)
+        {
+            printf("INVALID HISTORY_QUANTIZE_BITS %d\n", HISTORY_QUANTIZE_BITS);
+            exit(1);
+        }
+
+        HistoryFileHeader header;
+        char *parameters = NULL;
+        size_t parametersSize = 0;
+        FILE *ps = open_memstream(&parameters, &parametersSize);
+
+        writeParameters(ps, runNum);
+        fclose(ps);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+        header.version        = HISTORY_VERSION;
+        header.byteOrder      = HISTORY_BYTE_ORDER;
+        header.parametersSize = (uint32_t)parametersSize;
+        header.headerSize     = (uint32_t)((sizeof(header) + parametersSize + 7) & ~(size_t)7);
+        header.runNum         = runNum;
+        header.nAgents        = n_agents;
+        header.nTicks         = n_ticks;
+        header.nFeatures      = n_features;
+        header.omitRows       = OMIT_ROWS_FOR_AGENTS_NOT_UPDATED;
+        header.valueSize      = HISTORY_QUANTIZE_BITS ? HISTORY_QUANTIZE_BITS / 8 : sizeof(real);
+        header.valueEncoding  = HISTORY_QUANTIZE_BITS ? HISTORY_VALUES_FIXED : HISTORY_VALUES_REAL;
+        header.valueScale     = HISTORY_QUANTIZE_BITS ? (float)((1 << HISTORY_QUANTIZE_BITS) - 1) : 1.0f;
+        header.tickOffset     = 0;
+        header.agentOffset    = sizeof(int32_t);
+        header.senderOffset   = 2 * sizeof(int32_t);
+        header.inputsOffset   = (header.valueSize > 4) ? 4 * sizeof(int32_t) : 3 * sizeof(int32_t); // values aligned
+        header.outputsOffset  = header.inputsOffset + n_features * header.valueSize;
+        header.recordSize     = (header.outputsOffset + n_features * header.valueSize + 3) & ~3u;
+
+        history.recordSize   = header.recordSize;
+        history.inputsOffset = header.inputsOffset;
+        history.valueSize    = header.valueSize;
+        history.valueScale   = header.valueScale;
+        history.capacity     = (HISTORY_BUFFER_BYTES > history.recordSize) ? HISTORY_BUFFER_BYTES : history.recordSize;
+
+        if (historyFormat == HISTORY_COMPRESSED)
+        {
+            header.codec        = HISTORY_CODEC_ZLIB;
+            header.blockRecords = history.capacity / history.recordSize;
+            initHistoryCompression(header.blockRecords);
+        }
+
+        for (int b = 0; b < HISTORY_BUFFERS; b++)
+            if (!(history.block[b] = malloc(history.capacity)))
+            {
+                printf("OUT OF MEMORY FOR HISTORY BUFFERS\n");
+                exit(1);
+            }
+
+        history.buffer = history.block[0];
+
+        sprintf(filename, "history_%d.bin", runNum);
+        history.fp = resuming ? reopenOutput(filename, resumeFrom.historyOffset) : fopen(filename, "wb");
+
+        if (history.fp && !resuming)
+        {
+            char padding[8] = { 0 };
+
+            fwrite(&header, sizeof(header), 1, history.fp);
+            fwrite(parameters, 1, parametersSize, history.fp);
+            fwrite(padding, 1, header.headerSize - sizeof(header) - parametersSize, history.fp);
+        }
+
+        free(parameters);
+    }
+
+    if (!history.fp)
+    {
+        printf("COULD NOT WRITE %s\n", filename);
+        exit(1);
+    }
+
+    if (resuming) // the block index is put back by restoreCheckpoint
+    {
+        history.nRows    = resumeFrom.historyRows;
+        history.nRecords = resumeFrom.historyRecords;
+    }
+
+    if (historyFormat != HISTORY_TEXT && HISTORY_WRITER_THREAD)
+    {
+        pthread_mutex_init(&history.lock, NULL);
+        pthread_cond_init(&history.changed, NULL);
+
+        if (pthread_create(&history.thread, NULL, historyWriterThread, NULL))
+        {
+            printf("COULD NOT START HISTORY WRITER THREAD\n");
+            exit(1);
+        }
+
+        history.threaded = 1;
+    }
+}
+
+// byte-shuffles count items of the given width: all first bytes, then all second bytes, ...
+static char *shuffleBytes(char *to, const char *from, size_t count, size_t width)
+{
+    for (size_t b = 0; b < width; b++)
+        for (size_t i = 0; i < count; i++)
+            *to++ = from[i * width + b];
+
+    return to;
+}
+
+void initHistoryCompression(size_t blockRecords)
+{
+    size_t bitBytes = (n_features + 7) / 8;
+
+    // worst case: every record with an input mode, input values and outputs
+    history.columnsCapacity = blockRecords * (3 * sizeof(int32_t) + 1 + bitBytes + 2 * n_features * history.valueSize);
+    history.compressedCapacity = compressBound(history.columnsCapacity);
+
+    history.columns    = malloc(history.columnsCapacity);
+    history.shuffled   = malloc(history.columnsCapacity);
+    history.compressed = malloc(history.compressedCapacity);
+    history.lastRecord = malloc((size_t)n_agents * sizeof(uint32_t));
+    history.lastStamp  = calloc((size_t)n_agents, sizeof(uint32_t));
+
+    if (!history.columns || !history.shuffled || !history.compressed || !history.lastRecord || !history.lastStamp)
+    {
+        printf("OUT OF MEMORY FOR HISTORY COMPRESSION\n");
+        exit(1);
+    }
+}
+
+// stores n values, exactly or in fixed point
+static void storeHistoryValues(char *to, const real *from, int n)
+{
+    if (!HISTORY_QUANTIZE_BITS)
+    {
+        memcpy(to, from, n * sizeof(real));
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        real x = from[i] * history.valueScale;
+        uint16_t q = (x <= 0.0) ? 0 : (x >= history.valueScale) ? (uint16_t)history.valueScale : (uint16_t)lround(x);
+
+        if (history.valueSize == 1)
+            ((uint8_t *)to)[i] = (uint8_t)q;
+        else
+            memcpy(to + i * sizeof(q), &q, sizeof(q));
+    }
+}
+
+// value i of stored values, in the units of the stored values
+static double storedValue(const char *p, int i)
+{
+    if (!HISTORY_QUANTIZE_BITS)
+        return ((const real *)p)[i];
+    else if (history.valueSize == 1)
+        return ((const uint8_t *)p)[i];
+    else
+    {
+        uint16_t q;
+        memcpy(&q, p + i * sizeof(q), sizeof(q));
+        return q;
+    }
+}
+
+// whether every one of n_features stored values is 0 or 1 (stored as valueScale)
+static int storedValuesAreBinary(const char *p)
+{
+    double one = HISTORY_QUANTIZE_BITS ? history.valueScale : 1.0;
+
+    for (int i = 0; i < n_features; i++)
+    {
+        double v = storedValue(p, i);
+
+        if (v != 0.0 && v != one)
+            return 0;
+    }
+
+    return 1;
+}
+
+// encodes the records of a block as described in history.h and writes it
+static void writeCompressedBlock(const char *block, size_t size)
+{
+    uint32_t nRecords = size / history.recordSize;
+    size_t valuesSize = n_features * history.valueSize;
+    size_t bitBytes = (n_features + 7) / 8;
+
+    // the columns, each with room for every record of the block
+    int32_t *tick    = (int32_t *)history.columns;
+    int32_t *agent   = tick + nRecords;
+    int32_t *sender  = agent + nRecords;
+    uint8_t *mode    = (uint8_t *)(sender + nRecords);
+    uint8_t *bits    = mode + nRecords;
+    char    *inputs  = (char *)(bits + (size_t)nRecords * bitBytes);
+    char    *outputs = inputs + (size_t)nRecords * valuesSize;
+    size_t nBitRecords = 0, nValueRecords = 0;
+    int32_t head[3], previous[2] = { 0, 0 };
+
+    if (nRecords == 0)
+        return;
+
+    if (++history.stamp == 0) // the stamps wrapped around
+    {
+        memset(history.lastStamp, 0, (size_t)n_agents * sizeof(uint32_t));
+        history.stamp = 1;
+    }
+
+    for (uint32_t r = 0; r < nRecords; r++)
+    {
+        const char *record = block + (size_t)r * history.recordSize;
+        const char *in = record + history.inputsOffset;
+        char *out = outputs + (size_t)r * valuesSize;
+
+        memcpy(head, record, sizeof(head));
+        tick[r]   = head[0] - previous[0];
+        agent[r]  = head[1] - previous[1];
+        sender[r] = head[2];
+        previous[0] = head[0];
+        previous[1] = head[1];
+
+        if (head[2] == HISTORY_SENDER_NONE)
+            mode[r] = HISTORY_INPUTS_NONE;
+        else if (storedValuesAreBinary(in))
+        {
+            uint8_t *packed = bits + nBitRecords++ * bitBytes;
+
+            mode[r] = HISTORY_INPUTS_BITS;
+            memset(packed, 0, bitBytes);
+
+            for (int i = 0; i < n_features; i++)
+                if (storedValue(in, i) != 0.0)
+                    packed[i / 8] |= 1 << (i % 8);
+        }
+        else
+        {
+            mode[r] = HISTORY_INPUTS_VALUES;
+            memcpy(inputs + nValueRecords++ * valuesSize, in, valuesSize);
+        }
+
+        memcpy(out, record + history.inputsOffset + valuesSize, valuesSize);
+
+        int a = head[1];
+
+        if (a >= 0 && a < n_agents)
+        {
+            if (history.lastStamp[a] == history.stamp) // XOR with the agent's previous outputs
+            {
+                const char *last = block + (size_t)(history.lastRecord[a] - 1) * history.recordSize
+                                         + history.inputsOffset + valuesSize;
+
+                for (size_t k = 0; k < valuesSize; k++)
+                    out[k] ^= last[k];
+            }
+
+            history.lastStamp[a]  = history.stamp;
+            history.lastRecord[a] = r + 1;
+        }
+    }
+
+    char *end = shuffleBytes(history.shuffled, (char *)tick, 3 * (size_t)nRecords, sizeof(int32_t));
+
+    memcpy(end, mode, nRecords);
+    end += nRecords;
+    memcpy(end, bits, nBitRecords * bitBytes);
+    end += nBitRecords * bitBytes;
+    end = shuffleBytes(end, inputs, nValueRecords * n_features, history.valueSize);
+    end = shuffleBytes(end, outputs, (size_t)nRecords * n_features, history.valueSize);
+
+    HistoryBlockHeader blockHeader;
+    uLongf compressedSize = history.compressedCapacity;
+
+    memset(&blockHeader, 0, sizeof(blockHeader));
+    blockHeader.nRecords = nRecords;
+    blockHeader.rawSize  = (uint32_t)(end - history.shuffled);
+    memcpy(&blockHeader.firstTick, block, sizeof(int32_t));
+    memcpy(&blockHeader.lastTick, block + (size_t)(nRecords - 1) * history.recordSize, sizeof(int32_t));
+
+    if (compress2(history.compressed, &compressedSize, (Bytef *)history.shuffled, blockHeader.rawSize,
+                  HISTORY_COMPRESSION_LEVEL) != Z_OK)
+    {
+        printf("COULD NOT COMPRESS HISTORY\n");
+        exit(1);
+    }
+
+    blockHeader.compressedSize = (uint32_t)compressedSize;
+
+    HistoryIndexEntry entry = { (uint64_t)ftello(history.fp), history.nRecords, nRecords,
+                                blockHeader.firstTick, blockHeader.lastTick, 0 };
+
+    if (fwrite(&blockHeader, sizeof(blockHeader), 1, history.fp) != 1 ||
+        fwrite(history.compressed, 1, compressedSize, history.fp) != compressedSize)
+    {
+        printf("COULD NOT WRITE HISTORY\n");
+        exit(1);
+    }
+
+    if ((history.nBlocks & (history.nBlocks - 1)) == 0) // grow the index at powers of two
+        history.index = realloc(history.index, (history.nBlocks ? 2 * history.nBlocks : 1) * sizeof(HistoryIndexEntry));
+
+    history.index[history.nBlocks++] = entry;
+    history.nRecords += nRecords;
+    history.bytes += sizeof(blockHeader) + compressedSize;
+}
+
+static void writeHistoryBlock(const char *block, size_t size)
+{
+    double start = wallSeconds();
+
+    history.rawBytes += size;
+
+    if (historyFormat == HISTORY_COMPRESSED)
+        writeCompressedBlock(block, size);
+    else
+    {
+        if (size > 0 && fwrite(block, 1, size, history.fp) != size)
+        {
+            printf("COULD NOT WRITE HISTORY\n");
+            exit(1);
+        }
+
+        history.bytes += size;
+    }
+
+    history.writeSeconds += wallSeconds() - start;
+}
+
+// HISTORY_COMPRESSED: the block index and the trailer that ends the file
+static void writeHistoryIndex(void)
+{
+    HistoryIndexTrailer trailer;
+
+    memcpy(trailer.magic, HISTORY_INDEX_MAGIC, sizeof(trailer.magic));
+    trailer.indexOffset = (uint64_t)ftello(history.fp);
+    trailer.nBlocks     = history.nBlocks;
+
+    if ((history.nBlocks && fwrite(history.index, sizeof(HistoryIndexEntry), history.nBlocks, history.fp) != history.nBlocks) ||
+        fwrite(&trailer, sizeof(trailer), 1, history.fp) != 1)
+    {
+        printf("COULD NOT WRITE HISTORY\n");
+        exit(1);
+    }
+}
+
+static void *historyWriterThread(void *arg)
+{
+    pthread_mutex_lock(&history.lock);
+
+    for (;;)
+    {
+        while (history.nFull == 0 && !history.done)
+            pthread_cond_wait(&history.changed, &history.lock);
+
+        if (history.nFull == 0)
+            break;
+
+        int b = history.head;
+
+        pthread_mutex_unlock(&history.lock);
+        writeHistoryBlock(history.block[b], history.blockUsed[b]);
+        pthread_mutex_lock(&history.lock);
+
+        history.head = (history.head + 1) % HISTORY_BUFFERS;
+        history.nFull--;
+        pthread_cond_broadcast(&history.changed);
+    }
+
+    pthread_mutex_unlock(&history.lock);
+    return NULL;
+}
+
+// hands the block being filled to the writer thread and takes the next one, or writes it
+static void flushHistory(void)
+{
+    if (!history.threaded)
+    {
+        writeHistoryBlock(history.buffer, history.used);
+        history.used = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&history.lock);
+
+    int b = (history.head + history.nFull) % HISTORY_BUFFERS;
+
+    history.blockUsed[b] = history.used;
+    history.nFull++;
+    pthread_cond_broadcast(&history.changed);
+
+    if (history.nFull == HISTORY_BUFFERS) // every block is full: wait for the writer
+    {
+        double start = wallSeconds();
+
+        while (history.nFull == HISTORY_BUFFERS)
+            pthread_cond_wait(&history.changed, &history.lock);
+
+        history.waitSeconds += wallSeconds() - start;
+    }
+
+    history.buffer = history.block[(b + 1) % HISTORY_BUFFERS];
+    history.used = 0;
+    pthread_mutex_unlock(&history.lock);
+}
+
+// One row of the history: agent and sender are original agent numbers, sender can also be
+// one of the HISTORY_SENDER_ codes, and inputs are ignored for HISTORY_SENDER_NONE.
+void writeHistoryRow(int tick, int agent, int sender, const real *inputs, const real *outputs)
+{
+    int i;
+
+    if (historyFormat == HISTORY_NONE)
+        return;
+
+    history.nRows++;
+
+    if (historyFormat == HISTORY_TEXT)
+    {
+        FILE *fp = history.fp;
+
+        if (sender == HISTORY_SENDER_PRETRAINING)
+            fprintf(fp, "%d %d - - ", tick, agent);  // tick 0 (or of creation, LAZY_AGENTS) and agent number
+        else if (sender == HISTORY_SENDER_NONE)
+            fprintf(fp, "%d %d 0 - ", tick, agent);
+        else if (sender == HISTORY_SENDER_PROTOTYPE)
+            fprintf(fp, "%d %d 1 P ", tick, agent);
+        else
+            fprintf(fp, "%d %d 1 %d ", tick, agent, sender);
+
+        for (i = 0;  i < n_features; i++)
+        {
+            if (sender == HISTORY_SENDER_NONE)
+                fprintf(fp, "- ");
+            else
+                fprintf(fp, "%f ", inputs[i]);
+        }
+
+        for (i = 0;  i < n_features; i++)
+            fprintf(fp, "%f ", outputs[i]);
+
+        fprintf(fp, "\n");
+        return;
+    }
+
+    if (history.used + history.recordSize > history.capacity)
+        flushHistory();
+
+    char *record = history.buffer + history.used;
+    int32_t head[3] = { tick, agent, sender };
+
+    memset(record, 0, history.recordSize);
+    memcpy(record, head, sizeof(head));
+
+    if (sender != HISTORY_SENDER_NONE)
+        storeHistoryValues(record + history.inputsOffset, inputs, n_features);
+
+    storeHistoryValues(record + history.inputsOffset + n_features * history.valueSize, outputs, n_features);
+    history.used += history.recordSize;
+}
+
+void closeHistory(void)
+{
+    if (historyFormat == HISTORY_NONE)
+        return;
+
+    if (historyFormat != HISTORY_TEXT && history.used > 0)
+        flushHistory();
+
+    if (history.threaded)
+    {
+        pthread_mutex_lock(&history.lock);
+        history.done = 1;
+        pthread_cond_broadcast(&history.changed);
+        pthread_mutex_unlock(&history.lock);
+
+        pthread_join(history.thread, NULL);
+        pthread_mutex_destroy(&history.lock);
+        pthread_cond_destroy(&history.changed);
+    }
+
+    if (historyFormat == HISTORY_COMPRESSED)
+        writeHistoryIndex();
+
+    fclose(history.fp);
+
+    for (int b = 0; b < HISTORY_BUFFERS; b++)
+        free(history.block[b]);
+
+    free(history.columns);
+    free(history.shuffled);
+    free(history.compressed);
+    free(history.lastRecord);
+    free(history.lastStamp);
+    free(history.index);
+    free(history.agentSelected);
+
+    printf("%ld history rows", history.nRows);
+    if (historyFormat != HISTORY_TEXT)
+        printf(", %.1f MB written in %.3f seconds, simulation waited %.3f seconds for the writer",
+               history.bytes / 1e6, history.writeSeconds, history.waitSeconds);
+    if (historyFormat == HISTORY_COMPRESSED)
+        printf(" (%.1f MB uncompressed)", history.rawBytes / 1e6);
+    printf("\n");
+
+    memset(&history, 0, sizeof(history));
+}
+
+// Population metrics computed during the run, so that sweeps can do without the history
+// (HISTORY_NONE).  After pretraining and then every METRICS_EVERY_K_TICKS ticks a line is
+// added to metrics_%d.txt with
+//
+//   the tick
+//   the mean output over all agents and features
+//   the mean over pairs of agents of the squared Euclidean distance between their outputs
+//   the mean over pairs of agents of the Hamming distance between their thresholded outputs
+//   the number of distinct thresholded output vectors (patterns)
+//   for each feature, the fraction of agents whose thresholded output equals uber_prototype
+//
+// where outputs are thresholded at METRICS_THRESHOLD.  Only the receiver's outputs change in
+// a tick, so instead of going through all agents the metrics are updated by taking the
+// receiver out before its outputs are computed and putting it back afterwards.  They are
+// kept as per feature sums of outputs and of ones, the sum of squared output norms, and a
+// hash table counting the agents having each pattern.  The sum over pairs of |x_a - x_b|^2
+// is n * sum |x_a|^2 - |sum x_a|^2, and feature i differs in ones_i * (n - ones_i) pairs, so
+// a tick costs O(n_features) whatever the number of agents.
+//
+// The hash table uses open addressing with linear probing.  A pattern no agent has any more
+// keeps its slot with a count of 0; when more than half of the slots are in use the table is
+// rebuilt from the patterns of the agents, which happens at most every n_agents / 4 ticks.
+
+typedef struct Metrics
+{
+    FILE     *fp;
+    double   *sum;        // per feature, of the outputs of all agents
+    int      *ones;       // per feature, agents whose thresholded output is 1
+    double    sumSquares; // of the squared norms of the outputs of all agents
+    int       nWords;     // uint64_t words of a pattern
+    uint64_t *pattern;    // thresholded outputs of each agent, first feature in the lowest bit
+    uint64_t *keys;       // pattern of each slot of the hash table
+    int      *counts;     // agents with the pattern of each slot, -1 for an empty slot
+    int       capacity;   // slots, a power of two
+    int       nUsed;      // slots not empty
+    int       nDistinct;  // slots with a count above 0
+} Metrics;
+
+Metrics metrics;
+
+static uint64_t hashPattern(const uint64_t *p)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+
+    for (int w = 0; w < metrics.nWords; w++)
+    {
+        h ^= p[w];
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+// adds delta to the number of agents with pattern p
+static void countPattern(const uint64_t *p, int delta)
+{
+    size_t bytes = metrics.nWords * sizeof(uint64_t);
+    int slot = (int)(hashPattern(p) & (uint64_t)(metrics.capacity - 1));
+
+    while (metrics.counts[slot] >= 0 && memcmp(&metrics.keys[(size_t)slot * metrics.nWords], p, bytes))
+        slot = (slot + 1) & (metrics.capacity - 1);
+
+    if (metrics.counts[slot] < 0)
+    {
+        memcpy(&metrics.keys[(size_t)slot * metrics.nWords], p, bytes);
+        metrics.counts[slot] = 0;
+        metrics.nUsed++;
+    }
+
+    if (metrics.counts[slot] == 0)
+        metrics.nDistinct++;
+
+    metrics.counts[slot] += delta;
+
+    if (metrics.counts[slot] == 0)
+        metrics.nDistinct--;
+}
+
+static void rebuildPatternTable(void)
+{
+    for (int slot = 0; slot < metrics.capacity; slot++)
+        metrics.counts[slot] = -1;
+
+    metrics.nUsed = 0;
+    metrics.nDistinct = 0;
+
+    for (int a = 0; a < n_agents; a++)
+        countPattern(&metrics.pattern[(size_t)a * metrics.nWords], 1);
+}
+
+// takes the outputs of agent a out of the metrics
+void removeAgentMetrics(int a)
+{
+    if (!metrics.fp)
+        return;
+
+    uint64_t *p = &metrics.pattern[(size_t)a * metrics.nWords];
+
+    for (int i = 0; i < n_features; i++)
+    {
+        metrics.sum[i] -= outputs[a][i];
+        metrics.sumSquares -= (double)outputs[a][i] * outputs[a][i];
+        metrics.ones[i] -= (int)((p[i / 64] >> (i % 64)) & 1);
+    }
+
+    countPattern(p, -1);
+}
+
+// sets the pattern of agent a from its outputs
+static uint64_t *setAgentPattern(int a)
+{
+    uint64_t *p = &metrics.pattern[(size_t)a * metrics.nWords];
+
+    memset(p, 0, metrics.nWords * sizeof(uint64_t));
+
+    for (int i = 0; i < n_features; i++)
+        if (outputs[a][i] >= METRICS_THRESHOLD)
+            p[i / 64] |= 1ULL << (i % 64);
+
+    return p;
+}
+
+// puts the outputs of agent a into the metrics
+void addAgentMetrics(int a)
+{
+    if (!metrics.fp)
+        return;
+
+    uint64_t *p = setAgentPattern(a);
+
+    for (int i = 0; i < n_features; i++)
+    {
+        metrics.sum[i] += outputs[a][i];
+        metrics.sumSquares += (double)outputs[a][i] * outputs[a][i];
+        metrics.ones[i] += (int)((p[i / 64] >> (i % 64)) & 1);
+    }
+
+    countPattern(p, 1);
+
+    if (2 * metrics.nUsed > metrics.capacity)
+        rebuildPatternTable();
+}
+
+void writeMetrics(int tick)
+{
+    if (!metrics.fp || tick % METRICS_EVERY_K_TICKS != 0)
+        return;
+
+    double n = n_agents;
+    double pairs = n * (n - 1.0) / 2.0;
+    double total = 0.0, normSquared = 0.0, hamming = 0.0;
+
+    for (int i = 0; i < n_features; i++)
+    {
+        total += metrics.sum[i];
+        normSquared += metrics.sum[i] * metrics.sum[i];
+        hamming += (double)metrics.ones[i] * (n_agents - metrics.ones[i]);
+    }
+
+    fprintf(metrics.fp, "%d %f %f %f %d", tick, total / (n * n_features),
+            pairs > 0.0 ? (n * metrics.sumSquares - normSquared) / pairs : 0.0,
+            pairs > 0.0 ? hamming / pairs : 0.0, metrics.nDistinct);
+
+    for (int i = 0; i < n_features; i++)
+    {
+        int agree = (uber_prototype[i] >= METRICS_THRESHOLD) ? metrics.ones[i] : n_agents - metrics.ones[i];
+        fprintf(metrics.fp, " %f", agree / n);
+    }
+    fprintf(metrics.fp, "\n");
+}
+
+// called after pretraining, or by restoreCheckpoint, which then puts the sums back
+void initMetrics(int runNum)
+{
+    char filename[40];
+
+    memset(&metrics, 0, sizeof(metrics));
+
+    if (METRICS_EVERY_K_TICKS <= 0)
+        return;
+
+    metrics.nWords = (n_features + 63) / 64;
+    metrics.capacity = 4;
+    while (metrics.capacity < 4 * n_agents)
+        metrics.capacity *= 2;
+
+    metrics.sum = calloc(n_features, sizeof(double));
+    metrics.ones = calloc(n_features, sizeof(int));
+    metrics.pattern = calloc((size_t)n_agents * metrics.nWords, sizeof(uint64_t));
+    metrics.keys = malloc((size_t)metrics.capacity * metrics.nWords * sizeof(uint64_t));
+    metrics.counts = malloc((size_t)metrics.capacity * sizeof(int));
+
+    if (!metrics.sum || !metrics.ones || !metrics.pattern || !metrics.keys || !metrics.counts)
+    {
+        printf("NOT ENOUGH MEMORY FOR METRICS\n");
+        exit(1);
+    }
+
+    for (int slot = 0; slot < metrics.capacity; slot++)
+        metrics.counts[slot] = -1;
+
+    sprintf(filename, "metrics_%d.txt", runNum);
+    metrics.fp = resuming ? reopenOutput(filename, resumeFrom.metricsOffset) : fopen(filename, "w");
+
+    if (!metrics.fp)
+    {
+        printf("COULD NOT WRITE %s\n", filename);
+        exit(1);
+    }
+
+    if (resuming)
+        return;
+
+    fprintf(metrics.fp, "<tick#> <mean output> <mean pairwise squared distance> <mean pairwise hamming distance> "
+                        "<distinct patterns> <%d agreements with uber_prototype>\n\n", n_features);
+
+    for (int a = 0; a < n_agents; a++)
+        addAgentMetrics(a);
+
+    writeMetrics(0);
+}
+
+void concludeMetrics(void)
+{
+    if (metrics.fp)
+        fclose(metrics.fp);
+
+    free(metrics.sum);
+    free(metrics.ones);
+    free(metrics.pattern);
+    free(metrics.keys);
+    free(metrics.counts);
+    memset(&metrics, 0, sizeof(metrics));
+}
+
+void writeParameters(FILE *fp, int runNum)
+{
+    fprintf(fp, "n_agents %d\n",   n_agents);
+    fprintf(fp, "n_ticks %d\n",    n_ticks);
+    fprintf(fp, "n_features %d\n", n_features);
+    fprintf(fp, "proportion_hidden %f\n", proportion_hidden);
+    fprintf(fp, "n_hidden %d\n",   n_hidden);
+    fprintf(fp, "N_RUNS %d\n",     N_RUNS);
+
+    
+    if (SEED < 0)
+        fprintf(fp, "SEED based on time\n");
+    else
+        fprintf(fp, "SEED %d\n", SEED);
+
+    fprintf(fp, "proto_p_on %f\n",   proto_p_on);
+    fprintf(fp, "proto_p_flip %f\n", proto_p_flip);
+    fprintf(fp, "item_p_flip %f\n",  item_p_flip);
+
+    fprintf(fp, "SOCIAL_PROB_ALGORITHM %s\n", SOCIAL_PROB_ALGORITHM);
+    fprintf(fp, "social_prob_parameter %f\n", social_prob_parameter);
+
+    fprintf(fp, "LEARNING_RATE %f\n", LEARNING_RATE);
+    fprintf(fp, "MOMENTUM %f\n",      MOMENTUM);
+
+    fprintf(fp, "GRAPH_TYPE %s\n", graphTypeName(graphType));
+    fprintf(fp, "GRAPH_ORIGIN %s\n", graphOriginName(graphOrigin));
+
+    switch(graphType)
+    {
+        case WATTS_STROGATZ:
+        case IMPLICIT_WATTS_STROGATZ:
+        case IGRAPH_WATTS_STROGATZ:
+            fprintf(fp, "NEIGHBORHOOD %d\n", NEIGHBORHOOD);
+            fprintf(fp, "PROB_REWIRE %f\n",  PROB_REWIRE);
+            break;
+
+        case ERDOS_RENYI_GNM:
+        case ERDOS_RENYI_GNP:
+            fprintf(fp, "MEAN_DEGREE %f\n", MEAN_DEGREE);
+            break;
+
+        case BARABASI_ALBERT:
+            fprintf(fp, "BA_EDGES_PER_AGENT %d\n", BA_EDGES_PER_AGENT);
+            break;
+
+        case STOCHASTIC_BLOCK:
+            fprintf(fp, "MEAN_DEGREE %f\n",  MEAN_DEGREE);
+            fprintf(fp, "SBM_N_BLOCKS %d\n", SBM_N_BLOCKS);
+            fprintf(fp, "SBM_MIXING %f\n",   SBM_MIXING);
+            break;
+
+        case GRAPH_FROM_FILE:
+        {
+            char filename[1024];
+
+            graphFileName(filename, sizeof(filename), runNum);
+            fprintf(fp, "GRAPH_FILE %s\n", filename);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    fprintf(fp, "REWIRE_RATE %f\n", REWIRE_RATE);
+
+    if (REWIRE_RATE > 0.0)
+    {
+        fprintf(fp, "REWIRE_RULE %s\n", rewireRuleName(rewireRule));
+        if (rewireRule == REWIRE_HOMOPHILY)
+            fprintf(fp, "REWIRE_CANDIDATES %d\n", REWIRE_CANDIDATES);
+    }
+
+    fprintf(fp, "AGENT_ORDER %s\n", agentOrderName(agentOrder));
+    if (agentOrder == COMMUNITY_ORDER)
+        fprintf(fp, "COMMUNITY_ROUNDS %d\n", COMMUNITY_ROUNDS);
+
+    fprintf(fp, "SAMPLING_MODE %s\n", samplingModeName(samplingMode));
+
+    if (samplingMode != EDGE_UNIFORM)
+        fprintf(fp, "ZERO_DEGREE_POLICY %s\n", zeroDegreePolicyName(zeroDegreePolicy));
+
+    fprintf(fp, "WEIGHT_MODE %s\n", weightModeName(weightMode));
+
+    if (weightMode != UNWEIGHTED)
+    {
+        fprintf(fp, "WEIGHT_SOURCE %s\n", weightSourceName(weightSource));
+
+        if (weightSource == WEIGHTS_FROM_FILE)
+            fprintf(fp, "EDGE_WEIGHT_FILE %s\n", EDGE_WEIGHT_FILE);
+        else if (weightSource == WEIGHTS_LOGNORMAL)
+            fprintf(fp, "WEIGHT_LOGNORMAL_SIGMA %f\n", WEIGHT_LOGNORMAL_SIGMA);
+
+        if (weightMode == DYNAMIC_WEIGHTS)
+            fprintf(fp, "WEIGHT_REINFORCEMENT %f\n", WEIGHT_REINFORCEMENT);
+    }
+
+    fprintf(fp, "HISTORY_FORMAT %s\n", historyFormatName(historyFormat));
+
+    if (historyFormat != HISTORY_NONE)
+    {
+        fprintf(fp, "HISTORY_POLICY %s\n", historyPolicyName(historyPolicy));
+
+        if (historyPolicy == HISTORY_EVERY_NTH_TICK)
+            fprintf(fp, "HISTORY_EVERY_N_TICKS %d\n", HISTORY_EVERY_N_TICKS);
+        else if (historyPolicy == HISTORY_AGENT_SUBSET)
+            fprintf(fp, "HISTORY_AGENTS %s\n", HISTORY_AGENTS);
+
+        if (SNAPSHOT_EVERY_K_TICKS > 0)
+            fprintf(fp, "SNAPSHOT_EVERY_K_TICKS %d\n", SNAPSHOT_EVERY_K_TICKS);
+    }
+
+    if ((historyFormat == HISTORY_BINARY || historyFormat == HISTORY_COMPRESSED) && HISTORY_QUANTIZE_BITS)
+    {
+        fprintf(fp, "HISTORY_QUANTIZE_BITS %d\n", HISTORY_QUANTIZE_BITS);
+        fprintf(fp, "HISTORY_MAX_QUANTIZATION_ERROR %g\n", 0.5 / (ldexp(1.0, HISTORY_QUANTIZE_BITS) - 1.0));
+    }
+
+    if (METRICS_EVERY_K_TICKS > 0)
+    {
+        fprintf(fp, "METRICS_EVERY_K_TICKS %d\n", METRICS_EVERY_K_TICKS);
+        fprintf(fp, "METRICS_THRESHOLD %f\n", METRICS_THRESHOLD);
+    }
+
+    if (CHECKPOINT_EVERY_K_TICKS > 0)
+        fprintf(fp, "CHECKPOINT_EVERY_K_TICKS %d\n", CHECKPOINT_EVERY_K_TICKS);
+
+    if (PRETRAINED_SNAPSHOTS)
+        fprintf(fp, "PRETRAINED_SNAPSHOTS %d\n", PRETRAINED_SNAPSHOTS);
+
+    if (WEIGHT_TEMPLATES)
+        fprintf(fp, "WEIGHT_TEMPLATES %d\n", WEIGHT_TEMPLATES);
+
+    if (weightStorage != WEIGHTS_FULL)
+        fprintf(fp, "WEIGHT_STORAGE %s\n", weightStorageName(weightStorage));
+
+    if (LAZY_AGENTS)
+        fprintf(fp, "LAZY_AGENTS %d\n", LAZY_AGENTS);
+
+    if (AGENT_STATE_FILE[0])
+        fprintf(fp, "AGENT_STATE_FILE %s\n", AGENT_STATE_FILE);
+
+    if (SCHEDULE_LOOKAHEAD)
+        fprintf(fp, "SCHEDULE_LOOKAHEAD %d\n", SCHEDULE_LOOKAHEAD);
+
+    if (AGENT_HUGE_PAGES)
+        fprintf(fp, "AGENT_HUGE_PAGES %d\n", AGENT_HUGE_PAGES);
+
+    if (AGENT_NUMA_NODE != -1)
+        fprintf(fp, "AGENT_NUMA_NODE %d\n", AGENT_NUMA_NODE);
+}
+
+void storeParameters(int runNum)
+{
+    FILE *fp;
+    char filename[40];
+
+    sprintf(filename, "parameters_%d.txt", runNum);
+    fp = fopen(filename, "w");
+    writeParameters(fp, runNum);
+    fclose(fp);
+
+    printf("n_agents %d\n",   n_agents);
+    printf("n_ticks %d\n",    n_ticks);
+    printf("n_features %d\n", n_features);
+    printf("proportion_hidden %f\n", proportion_hidden);
+    printf("n_hidden %d\n",   n_hidden);
+    printf("proto_p_on %f\n",   proto_p_on);
+    printf("proto_p_flip %f\n", proto_p_flip);
+    printf("item_p_flip %f\n",  item_p_flip);
+    printf("social_prob_parameter %f\n", social_prob_parameter);
+    printf("runNum %d\n\n\n\n", runNum);
+}
+
+// save inputs & outputs of agent
+void saveInputsOutputs(real *inputs, real *outputs)	// from tlnes.c
+{
+  int i ;
+  int nIn = Net->numInputs ;
+  int nOut = Net->numOutputs ;
+  for (i = 0 ; i < nIn  ; i++) inputs[i] = Net->input[i]->output ;
+  for (i = 0 ; i < nOut ; i++) outputs[i] = Net->output[i]->output ;
+}
+
+// save outputs of agent
+void saveOutputs(real *outs)	// from tlens.c
+{
+  int i ;
+  int nOut = Net->numOutputs ;
+  for (i = 0 ; i < nOut ; i++) outs[i] = Net->output[i]->output ;
+}
+
+void printVector(real* vec, int len)
+{
+  int i ;
+
+  if (!DISPLAY_TO_SCREEN) return;
+
+  for (i = 0 ; i < len  ; i++) printf("%.2f ", vec[i]) ;
+  printf("\n");
+}
+
+void fprintVector(FILE *fp, real* vec, int len)
+{
+  int i ;
+
+  for (i = 0 ; i < len  ; i++) fprintf(fp, "%.2f ", vec[i]) ;
+  fprintf(fp, "\n");
+}
+
+
+void createExampleSet(real *inputs, real *targets)
+{
+  // uses fixed example set name: train
+  // assumes all nets have same sized inputs/outputs
+  // this copies inputs to inputs and targets to targets
+  int i, pos ;
+  int nIn = Net->numInputs ;
+  int nOut = Net->numOutputs ;
+  char cmd[CMDLEN];
+//  printf("in=%d, out=%d\n", nIn, nOut);
+
+  pos = sprintf(cmd, "loadExamples \"|echo \\\"I: ");
+  for (i = 0 ; i < nIn  ; i++)
+  {
+     pos += sprintf(cmd+pos, "%.0f ", inputs[i]);
+//     printf("******** length(cmd)=%ld, pos=%d **********\n\n", strlen(cmd), pos);
+//     printf("cmd=%s\n\n", cmd);
+  }
+
+  pos += sprintf(cmd+pos, " T: ");
+  for (i = 0 ; i < nOut  ; i++)
+  {
+      pos += sprintf(cmd+pos, "%.0f ", targets[i]);
+//     printf("********* length(cmd)=%ld, pos=%d **********\n\n", strlen(cmd), pos);
+//     printf("cmd=%s\n\n", cmd);
+  }
+
+  sprintf(cmd+pos, ";\\\"\" -s train -mode REPLACE\n");
+//  printf("ready to call createExampleSet/lens(cmd)\n");
+  lens(cmd);
+}
+
+// dcp
+void overwriteExample(real *inputs, real *targets)
+{
+  // will overwrite first event of first example of current training set
+  int i ;
+  int nIn = Net->numInputs ;
+  int nOut = Net->numOutputs ;
+  real *exInputs  = Net->trainingSet->firstExample->event->input->val ;
+  real *exTargets = Net->trainingSet->firstExample->event->target->val ;
+  for (i = 0 ; i < nIn  ; i++) exInputs[i] = inputs[i] ;
+  for (i = 0 ; i < nOut ; i++) exTargets[i] = targets[i] ;
+}
+
+
+// Agent arenas.  The rows of allocAgentState and the pool of private weight blocks are each
+// one anonymous mapping, so that they can be given huge pages and a NUMA placement.  With
+// AGENT_HUGE_PAGES 1 they are marked MADV_HUGEPAGE, for transparent huge pages; with 2 they
+// are mapped from the explicit huge pages of the system (MAP_HUGETLB), or marked for
+// transparent ones when there are not enough.  AGENT_NUMA_NODE binds them to a node, or with
+// AGENT_NUMA_INTERLEAVE spreads them over all nodes; by default their pages are on the node of
+// the first thread that touches them.  The simulation runs the ticks in one thread, so binding
+// the arenas to the node of the CPU it is pinned to (numactl --cpunodebind=N, or taskset) is
+// what keeps agent state local.  When a run ends, where the pages of each arena are is
+// reported, from move_pages on a sample of them, with the huge pages of the process.
+
+#define HUGE_PAGE_SIZE        (2 << 20)
+#define PLACEMENT_SAMPLES     4096
+#define MAX_NUMA_NODES        64
+
+typedef struct AgentArena
+{
+    char  *base;
+    size_t size;          // as mapped
+    int    hugeTlb;       // MAP_HUGETLB
+} AgentArena;
+
+static void placeAgentArena(AgentArena *arena)
+{
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    int mode;
+
+    if (AGENT_NUMA_NODE == -1)
+        return;
+
+    if (AGENT_NUMA_NODE == AGENT_NUMA_INTERLEAVE)
+    {
+        FILE *fp = fopen("/sys/devices/system/node/online", "r");
+        int first, last;
+        char sep;
+
+        mode = 3;  // MPOL_INTERLEAVE
+
+        while (fp && fscanf(fp, "%d", &first) == 1)
+        {
+            last = first;
+            if (fscanf(fp, "%c", &sep) == 1 && sep == '-' && fscanf(fp, "%d%c", &last, &sep) < 1)
+                break;
+            for (int node = first; node <= last && node < MAX_NUMA_NODES; node++)
+                mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+            if (sep != ',')
+                break;
+        }
+
+        if (fp)
+            fclose(fp);
+    }
+    else
+    {
+        mode = 2;  // MPOL_BIND
+        mask[AGENT_NUMA_NODE / (8 * sizeof(unsigned long))] |= 1UL << (AGENT_NUMA_NODE % (8 * sizeof(unsigned long)));
+    }
+
+    if (syscall(SYS_mbind, arena->base, arena->size, mode, mask, (unsigned long)MAX_NUMA_NODES + 1, 0) != 0)
+        printf("could not place the agent arena on NUMA node(s) %d, it is left to the kernel\n", AGENT_NUMA_NODE);
+}
+
+// an arena of size zeroed bytes, page aligned
+AgentArena mapAgentArena(size_t size)
+{
+    AgentArena arena = { MAP_FAILED, size, 0 };
+
+    if (size == 0)
+        arena.size = size = 1;
+
+    if (AGENT_HUGE_PAGES == 2)
+    {
+        arena.size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        arena.base = mmap(NULL, arena.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        arena.hugeTlb = (arena.base != MAP_FAILED);
+
+        if (!arena.hugeTlb)
+            arena.size = size;
+    }
+
+    if (arena.base == MAP_FAILED)
+    {
+        arena.base = mmap(NULL, arena.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (arena.base == MAP_FAILED)
+        {
+            printf("NOT ENOUGH MEMORY FOR THE AGENT ARENA (%zu BYTES)\n", size);
+            exit(1);
+        }
+
+        if (AGENT_HUGE_PAGES)
+            madvise(arena.base, arena.size, MADV_HUGEPAGE);
+    }
+
+    placeAgentArena(&arena);
+    return arena;
+}
+
+// transparent huge pages of the process, -1 if unknown
+long anonHugePagesKb(void)
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    char line[128];
+    long kb = -1;
+
+    while (fp && fgets(line, sizeof(line), fp))
+        if (sscanf(line, "AnonHugePages: %ld", &kb) == 1)
+            break;
+
+    if (fp)
+        fclose(fp);
+
+    return kb;
+}
+
+// where the pages of an arena are, from move_pages on up to PLACEMENT_SAMPLES of them
+void reportAgentArena(const char *what, const AgentArena *arena)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t nPages = (arena->size + page - 1) / page;
+    size_t n = nPages < PLACEMENT_SAMPLES ? nPages : PLACEMENT_SAMPLES;
+    void *pages[PLACEMENT_SAMPLES];
+    int status[PLACEMENT_SAMPLES];
+    long onNode[MAX_NUMA_NODES] = { 0 };
+    long notResident = 0, unknown = 0;
+
+    for (size_t i = 0; i < n; i++)
+        pages[i] = arena->base + (nPages * i / n) * page;
+
+    if (syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL, status, 0) != 0)
+        unknown = (long)n;
+
+    for (size_t i = 0; i < n && !unknown; i++)
+    {
+        if (status[i] >= 0 && status[i] < MAX_NUMA_NODES)
+            onNode[status[i]]++;
+        else
+            notResident++;
+    }
+
+    printf("%s: %.2f MB%s, %zu pages sampled:", what, (double)arena->size / (1 << 20),
+           arena->hugeTlb ? " of explicit huge pages" : AGENT_HUGE_PAGES ? " marked for huge pages" : "", n);
+
+    for (int node = 0; node < MAX_NUMA_NODES; node++)
+        if (onNode[node])
+            printf(" %ld on node %d,", onNode[node], node);
+
+    if (unknown)
+        printf(" placement unknown");
+    else
+        printf(" %ld not resident", notResident);
+
+    long hugeKb = AGENT_HUGE_PAGES && !arena->hugeTlb ? anonHugePagesKb() : -1;
+
+    if (hugeKb >= 0)
+        printf(", %.1f MB of transparent huge pages in the process", hugeKb / 1024.0);
+    printf("\n");
+}
+
+void unmapAgentArena(AgentArena *arena)
+{
+    if (arena->base && arena->base != MAP_FAILED)
+        munmap(arena->base, arena->size);
+
+    arena->base = NULL;
+    arena->size = 0;
+}
+
+
+
+// Agent state file.  With AGENT_STATE_FILE, the per-agent state of a run (the rows of
+// allocAgentState and, with WEIGHT_TEMPLATES, the private weight blocks) is kept in a file
+// mapped into memory instead of in anonymous memory, so populations whose state is larger
+// than RAM can run, with the kernel paging agents in and out.  The file is unlinked as soon as
+// it is created and disappears with the run.  It holds the rows, then the blocks from the next
+// page boundary, agent a's block at a * blockStride; blocks of agents still sharing their
+// template take no space, the file being sparse.
+//
+// With SCHEDULE_LOOKAHEAD, the receiver and sender of each tick are known that many ticks
+// ahead, and the pages they will need (the receiver's block and rows, the sender's outputs)
+// are asked for with MADV_WILLNEED when their tick is drawn, so they are read while other
+// ticks run.  After a tick, the block of an agent that no drawn tick needs is marked with
+// MADV_COLD (MADV_DONTNEED where there is none), so that it is paged out before the blocks
+// that will be needed.  Advice covers whole pages, so it can reach the neighbouring blocks;
+// it is only advice.  The I/O of the run is reported when it ends.
+
+typedef struct AgentStateFile
+{
+    int     fd;                // -1 when the state is in memory
+    char   *rows;              // mapping of the rows
+    size_t  rowsSize;          // page multiple
+    size_t  rowStride;
+    char   *blocks;            // mapping of the weight blocks
+    size_t  blocksSize;
+    size_t  blockStride;
+    long    nWillNeed;         // pages advised
+    long    nCold;
+    long    majorFaults;       // at the start of the run, then during it
+    long    minorFaults;
+    long long readBytes;       // of the process, from /proc/self/io; -1 if unknown
+    long long writeBytes;
+} AgentStateFile;
+
+AgentStateFile agentStateFile = { .fd = -1 };
+
+static void readProcessIo(long long *readBytes, long long *writeBytes)
+{
+    FILE *fp = fopen("/proc/self/io", "r");
+    char line[128];
+
+    *readBytes = *writeBytes = -1;
+
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        sscanf(line, "read_bytes: %lld", readBytes);
+        sscanf(line, "write_bytes: %lld", writeBytes);
+    }
+
+    if (fp)
+        fclose(fp);
+}
+
+static void *mapAgentState(size_t offset, size_t size)
+{
+    AgentStateFile *f = &agentStateFile;
+
+    if (ftruncate(f->fd, (off_t)(offset + size)) != 0)
+    {
+        printf("COULD NOT EXTEND THE AGENT STATE FILE\n");
+        exit(1);
+    }
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, (off_t)offset);
+
+    if (p == MAP_FAILED)
+    {
+        printf("COULD NOT MAP THE AGENT STATE FILE\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+// rows of size bytes, of rowStride bytes each, from the agent state file
+void *mapAgentStateRows(int runNum, size_t size, size_t rowStride)
+{
+    AgentStateFile *f = &agentStateFile;
+    char filename[4096];
+    struct rusage usage;
+
+    const char *format = AGENT_STATE_FILE;
+
+    snprintf(filename, sizeof(filename), format, runNum);
+
+    f->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    if (f->fd < 0)
+    {
+        printf("COULD NOT CREATE %s\n", filename);
+        exit(1);
+    }
+
+    unlink(filename);
+
+    long page = sysconf(_SC_PAGESIZE);
+
+    f->rowsSize  = (size + page - 1) / page * page;
+    f->rowStride = rowStride;
+    f->rows      = mapAgentState(0, f->rowsSize);
+
+    getrusage(RUSAGE_SELF, &usage);
+    f->majorFaults = usage.ru_majflt;
+    f->minorFaults = usage.ru_minflt;
+    readProcessIo(&f->readBytes, &f->writeBytes);
+
+    return f->rows;
+}
+
+// n blocks of blockSize bytes from the agent state file, after the rows
+char *mapAgentStateBlocks(int n, size_t blockSize)
+{
+    AgentStateFile *f = &agentStateFile;
+
+    f->blockStride = blockSize;
+    f->blocksSize  = (size_t)n * blockSize;
+    f->blocks      = mapAgentState(f->rowsSize, f->blocksSize);
+
+    return f->blocks;
+}
+
+void unmapAgentStateBlocks(void)
+{
+    AgentStateFile *f = &agentStateFile;
+
+    if (f->blocks)
+        munmap(f->blocks, f->blocksSize);
+
+    f->blocks = NULL;
+}
+
+// reports the I/O of the run and closes the file
+void closeAgentStateFile(int nAgents)
+{
+    AgentStateFile *f = &agentStateFile;
+    struct rusage usage;
+    long long readBytes, writeBytes;
+
+    getrusage(RUSAGE_SELF, &usage);
+    readProcessIo(&readBytes, &writeBytes);
+
+    printf("agent state file: %.1f MB for %d agents, %ld major and %ld minor page faults, "
+           "%ld pages advised needed, %ld cold",
+           (double)(f->rowsSize + f->blocksSize) / (1 << 20), nAgents, usage.ru_majflt - f->majorFaults,
+           usage.ru_minflt - f->minorFaults, f->nWillNeed, f->nCold);
+
+    if (readBytes >= 0 && f->readBytes >= 0)
+        printf(", %.1f MB read, %.1f MB written", (double)(readBytes - f->readBytes) / (1 << 20),
+               (double)(writeBytes - f->writeBytes) / (1 << 20));
+    printf("\n");
+
+    unmapAgentStateBlocks();
+    munmap(f->rows, f->rowsSize);
+    close(f->fd);
+
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+}
+
+static long adviseAgentState(char *base, size_t offset, size_t size, int advice)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t first = offset / page * page;
+    size_t end   = (offset + size + page - 1) / page * page;
+
+    madvise(base + first, end - first, advice);
+    return (long)((end - first) / page);
+}
+
+// pages agent receiver and the outputs of agent sender (if >= 0) will be needed
+void agentStateWillBeNeeded(int receiver, int sender)
+{
+    AgentStateFile *f = &agentStateFile;
+
+    if (f->fd < 0)
+        return;
+
+    // rows: uber_prototype, then the outputs, then the prototypes
+    f->nWillNeed += adviseAgentState(f->rows, (1 + (size_t)receiver) * f->rowStride, f->rowStride, MADV_WILLNEED);
+    f->nWillNeed += adviseAgentState(f->rows, (1 + (size_t)n_agents + receiver) * f->rowStride, f->rowStride, MADV_WILLNEED);
+
+    if (sender >= 0)
+        f->nWillNeed += adviseAgentState(f->rows, (1 + (size_t)sender) * f->rowStride, f->rowStride, MADV_WILLNEED);
+
+    if (f->blocks)
+        f->nWillNeed += adviseAgentState(f->blocks, (size_t)receiver * f->blockStride, f->blockStride, MADV_WILLNEED);
+}
+
+// the block of agent a will not be needed soon
+void agentStateNotNeeded(int a)
+{
+    AgentStateFile *f = &agentStateFile;
+
+    if (f->fd < 0 || !f->blocks)
+        return;
+
+#ifdef MADV_COLD
+    f->nCold += adviseAgentState(f->blocks, (size_t)a * f->blockStride, f->blockStride, MADV_COLD);
+#else
+    f->nCold += adviseAgentState(f->blocks, (size_t)a * f->blockStride, f->blockStride, MADV_DONTNEED);
+#endif
+}
+
+
+// Agent networks.  By default every agent has a Lens network of its own, agent%d.  With
+// WEIGHT_TEMPLATES N > 0 there is a single Lens network, agents, through which every agent is
+// trained, and each agent's weights and last weight changes (see copyNetLinks) are kept in a
+// block of 2 * nLinks reals outside Lens, a fraction of the size of a Lens network with its
+// units, link derivatives and other per-network objects.  useAgentNet loads an agent's block
+// into the network, after storing the weights of the agent that was there if it was trained.
+//
+// Blocks start as references to templates, the weights of the network after resetNet, shared
+// by the agents a with the same a % N, and an agent gets a private copy of its block the first
+// time it is trained.  With N >= n_agents every agent starts from weights of its own, reset
+// in the order of the agent%d networks.  Pretraining trains every agent once, so without
+// LAZY_AGENTS every agent has its private block after tick 0 and the saving that remains is
+// that of the block over a Lens network: sharing only lasts with LAZY_AGENTS, for the agents
+// not created yet.  Since agents with the same a % N start from the same weights, which
+// changes how the agents are initialized, N < n_agents is refused without LAZY_AGENTS.
+//
+// With LAZY_AGENTS, agents are not pretrained when the run starts but created the first time
+// they are the receiver or the sender of a tick (requireAgent): the agent is trained once on a
+// distortion of its prototype, drawn from a random stream of its own, and its pretraining row
+// is written with the tick of its creation.  Templates are made when an agent first needs
+// them, from a Lens seed of their own.  An agent is thus created the same way whenever it is,
+// and the drand48 numbers of the tick loop are the same whichever agents exist.  Agents not
+// yet created have outputs of 0 where the outputs of all agents are used: in the metrics, in
+// history rows of all agents and in REWIRE_HOMOPHILY.
+//
+// weightStorage is how blocks hold the weights and weight changes: as reals, or rounded to
+// 16 bits, bfloat16 (the exponent range of float, 8 significant bits) or IEEE half precision
+// (11 significant bits, magnitudes from 6e-8 to 65504), which halves the memory of the
+// blocks.  The network itself computes and trains in full precision; values are rounded when
+// an agent's weights are stored back after training.  historyquery compare measures how far
+// the outputs of such a run are from those of the full precision run with the same SEED.
+
+typedef struct AgentWeights
+{
+    uint32_t nLinks;
+    size_t   blockBytes;     // 2 * nLinks values of weightStorage
+    real    *values;         // 2 * nLinks reals, for converting blocks
+    int      nTemplates;
+    char    *templates;      // nTemplates blocks
+    char   **block;          // of each agent: its template or its private copy
+    char    *isPrivate;
+    int      nPrivate;
+    int      current;        // agent whose weights are in the network, -1 if none
+    int      trained;        // the current agent was trained since it was loaded
+    uint64_t seed;           // LAZY_AGENTS: of the templates and of the agents' pretraining
+    char    *templateMade;
+    char    *created;
+    int      nCreated;
+    char    *blockPool;      // the private blocks, agent a's at a * blockBytes: in poolArena,
+    AgentArena poolArena;    // or in the agent state file
+} AgentWeights;
+
+AgentWeights agentWeights;
+
+static inline uint16_t floatToBfloat16(float f)  // rounded to nearest even
+{
+    uint32_t x;
+
+    memcpy(&x, &f, sizeof(x));
+
+    if ((x & 0x7FFFFFFF) > 0x7F800000)
+        return (uint16_t)((x >> 16) | 0x40);  // NaN stays NaN
+
+    return (uint16_t)((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+}
+
+static inline float bfloat16ToFloat(uint16_t h)
+{
+    uint32_t x = (uint32_t)h << 16;
+    float f;
+
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static inline uint16_t floatToHalf(float f)  // rounded to nearest even
+{
+    uint32_t x, half, rest, halfway;
+
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t  exp  = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = x & 0x7FFFFF;
+
+    if (((x >> 23) & 0xFF) == 0xFF)
+        return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));  // infinity or NaN
+
+    if (exp >= 31)
+        return (uint16_t)(sign | 0x7C00);
+
+    if (exp <= 0)  // subnormal half, or 0
+    {
+        if (exp < -10)
+            return (uint16_t)sign;
+
+        int shift = 14 - exp;
+
+        mant |= 0x800000;
+        half = mant >> shift;
+        rest = mant & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else
+    {
+        half = ((uint32_t)exp << 10) | (mant >> 13);
+        rest = mant & 0x1FFF;
+        halfway = 0x1000;
+    }
+
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        half++;  // may carry into the exponent, up to infinity
+
+    return (uint16_t)(sign | half);
+}
+
+static inline float halfToFloat(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp  = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t x;
+    float f;
+
+    if (exp == 0)
+    {
+        f = (float)mant * (1.0f / 16777216.0f);  // 2^-24
+        return sign ? -f : f;
+    }
+
+    x = sign | (exp == 31 ? 0x7F800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// converts the 2 * nLinks values of a block
+static void encodeWeights(const real *values, char *block)
+{
+    uint16_t *h = (uint16_t *)block;
+    size_t n = 2 * (size_t)agentWeights.nLinks;
+
+    switch(weightStorage)
+    {
+        case WEIGHTS_FULL:
+            memcpy(block, values, n * sizeof(real));
+            break;
+
+        case WEIGHTS_BFLOAT16:
+            for (size_t i = 0; i < n; i++)
+                h[i] = floatToBfloat16((float)values[i]);
+            break;
+
+        case WEIGHTS_FLOAT16:
+            for (size_t i = 0; i < n; i++)
+                h[i] = floatToHalf((float)values[i]);
+            break;
+    }
+}
+
+static void decodeWeights(const char *block, real *values)
+{
+    const uint16_t *h = (const uint16_t *)block;
+    size_t n = 2 * (size_t)agentWeights.nLinks;
+
+    switch(weightStorage)
+    {
+        case WEIGHTS_FULL:
+            memcpy(values, block, n * sizeof(real));
+            break;
+
+        case WEIGHTS_BFLOAT16:
+            for (size_t i = 0; i < n; i++)
+                values[i] = bfloat16ToFloat(h[i]);
+            break;
+
+        case WEIGHTS_FLOAT16:
+            for (size_t i = 0; i < n; i++)
+                values[i] = halfToFloat(h[i]);
+            break;
+    }
+}
+
+// Copies the weight and last weight change of every link of the current network to values
+// (store) or back from values, two reals per link; returns the number of links.  values
+// can be NULL to count them.
+uint32_t copyNetLinks(real *values, int store)
+{
+    uint32_t n = 0;
+
+    for (int g = 0; g < Net->numGroups; g++)
+        for (int u = 0; u < Net->group[g]->numUnits; u++)
+        {
+            Unit unit = Net->group[g]->unit + u;
+
+            for (int l = 0; l < unit->numIncoming; l++, n++)
+            {
+                Link link = unit->incoming + l;
+
+                if (!values)
+                    continue;
+
+                if (store)
+                {
+                    values[2 * n]     = link->weight;
+                    values[2 * n + 1] = link->lastWeightDelta;
+                }
+                else
+                {
+                    link->weight          = values[2 * n];
+                    link->lastWeightDelta = values[2 * n + 1];
+                }
+            }
+        }
+
+    return n;
+}
+
+static void setNetObjects(void)
+{
+    lens("setObj learningRate %f", LEARNING_RATE);
+    lens("setObj momentum %f", MOMENTUM);
+    lens("setObj batchSize 1"); // DO WE NEED THIS?
+    lens("setObj reportInterval 1");  // DO WE NEED THIS?
+}
+
+int forksPretrainedSnapshot(int runNum);
+
+void createAgentNets(int runNum)
+{
+    if (LAZY_AGENTS && !WEIGHT_TEMPLATES)
+    {
+        printf("LAZY_AGENTS NEEDS WEIGHT_TEMPLATES\n");
+        exit(1);
+    }
+
+    if (WEIGHT_TEMPLATES > 0 && WEIGHT_TEMPLATES < n_agents && !LAZY_AGENTS)
+    {
+        printf("WEIGHT_TEMPLATES %d FOR %d AGENTS NEEDS LAZY_AGENTS\n", WEIGHT_TEMPLATES, n_agents);
+        exit(1);
+    }
+
+    if (PRETRAINED_SNAPSHOTS && (!WEIGHT_TEMPLATES || LAZY_AGENTS))
+    {
+        printf("PRETRAINED_SNAPSHOTS NEEDS WEIGHT_TEMPLATES AND NO LAZY_AGENTS\n");
+        exit(1);
+    }
+
+    if (weightStorage != WEIGHTS_FULL && !WEIGHT_TEMPLATES)
+    {
+        printf("%s NEEDS WEIGHT_TEMPLATES\n", weightStorageName(weightStorage));
+        exit(1);
+    }
+
+    if (!WEIGHT_TEMPLATES)
+    {
+        for (int a = 0 ; a < n_agents ; a++)
+        {
+            lens("addNet agent%d %d %d %d", a, n_features, n_hidden, n_features);
+            setNetObjects();
+            lens("resetNet");
+        }
+        return;
+    }
+
+    lens("addNet agents %d %d %d", n_features, n_hidden, n_features);
+    setNetObjects();
+
+    AgentWeights *w = &agentWeights;
+
+    w->nLinks     = copyNetLinks(NULL, 1);
+    w->blockBytes = 2 * (size_t)w->nLinks * (weightStorage == WEIGHTS_FULL ? sizeof(real) : sizeof(uint16_t));
+    w->values     = malloc(2 * (size_t)w->nLinks * sizeof(real));
+    w->nTemplates = WEIGHT_TEMPLATES < n_agents ? WEIGHT_TEMPLATES : n_agents;
+    w->templates  = malloc(w->nTemplates * w->blockBytes);
+    w->block      = malloc(n_agents * sizeof(char *));
+    w->isPrivate  = calloc(n_agents, 1);
+    w->nPrivate   = 0;
+    w->current    = -1;
+    w->trained    = 0;
+    w->seed       = graphSeed(runNum);
+    w->templateMade = calloc(w->nTemplates, 1);
+    w->created    = calloc(n_agents, 1);
+    w->nCreated   = 0;
+
+    if (!w->values || !w->templates || !w->block || !w->isPrivate || !w->templateMade || !w->created)
+    {
+        printf("NOT ENOUGH MEMORY FOR THE AGENT WEIGHTS\n");
+        exit(1);
+    }
+
+    if (agentStateFile.fd >= 0)
+        w->blockPool = mapAgentStateBlocks(n_agents, w->blockBytes);
+    else
+    {
+        w->poolArena = mapAgentArena((size_t)n_agents * w->blockBytes);
+        w->blockPool = w->poolArena.base;
+    }
+
+    // a run that forks a snapshot gets the blocks of the snapshot, so it needs no templates
+    for (int t = 0; t < w->nTemplates && !LAZY_AGENTS && !forksPretrainedSnapshot(runNum); t++)
+    {
+        lens("resetNet");
+        copyNetLinks(w->values, 1);
+        encodeWeights(w->values, w->templates + t * w->blockBytes);
+        w->templateMade[t] = 1;
+    }
+
+    for (int a = 0; a < n_agents; a++)
+        w->block[a] = w->templates + (a % w->nTemplates) * w->blockBytes;
+}
+
+void deleteAgentNets(void)
+{
+    AgentWeights *w = &agentWeights;
+
+    lens("deleteNets *");
+
+    if (!WEIGHT_TEMPLATES)
+        return;
+
+    if (LAZY_AGENTS)
+        printf("agents: %d of %d created\n", w->nCreated, n_agents);
+
+    printf("agent weights: %d of %d agents with private blocks, %.1f MB as %s\n", w->nPrivate, n_agents,
+           (double)(w->nPrivate + w->nTemplates) * w->blockBytes / (1 << 20), weightStorageName(weightStorage));
+
+    if (agentStateFile.fd >= 0)
+        unmapAgentStateBlocks();
+    else
+    {
+        reportAgentArena("agent weight blocks", &w->poolArena);
+        unmapAgentArena(&w->poolArena);
+    }
+
+    free(w->values);
+    free(w->templates);
+    free(w->block);
+    free(w->isPrivate);
+    free(w->templateMade);
+    free(w->created);
+    memset(w, 0, sizeof(*w));
+}
+
+// the block of agent a, made private first if it is still a template
+static char *privateAgentBlock(int a)
+{
+    AgentWeights *w = &agentWeights;
+
+    if (!w->isPrivate[a])
+    {
+        char *block = w->blockPool + (size_t)a * w->blockBytes;
+
+        memcpy(block, w->block[a], w->blockBytes);
+        w->block[a] = block;
+        w->isPrivate[a] = 1;
+        w->nPrivate++;
+    }
+
+    return w->block[a];
+}
+
+static void storeCurrentAgentWeights(void)
+{
+    AgentWeights *w = &agentWeights;
+
+    if (w->current < 0 || !w->trained)
+        return;
+
+    copyNetLinks(w->values, 1);
+    encodeWeights(w->values, privateAgentBlock(w->current));
+    w->trained = 0;
+}
+
+// makes the network of agent a the current network
+void useAgentNet(int a)
+{
+    if (!WEIGHT_TEMPLATES)
+    {
+        lens("useNet agent%d", a);
+        return;
+    }
+
+    if (a == agentWeights.current)
+        return;
+
+    storeCurrentAgentWeights();
+    decodeWeights(agentWeights.block[a], agentWeights.values);
+    copyNetLinks(agentWeights.values, 0);
+    agentWeights.current = a;
+}
+
+// the links of every agent's network
+uint32_t agentNetLinks(void)
+{
+    if (WEIGHT_TEMPLATES)
+        return agentWeights.nLinks;
+
+    lens("useNet agent%d", 0);
+    return copyNetLinks(NULL, 1);
+}
+
+// copies the links of agent a to values, in the layout of copyNetLinks; those of the current
+// agent come from the network, since they are only rounded to its block when it is stored
+void getAgentLinks(int a, real *values)
+{
+    if (!WEIGHT_TEMPLATES)
+    {
+        lens("useNet agent%d", a);
+        copyNetLinks(values, 1);
+        return;
+    }
+
+    if (a == agentWeights.current)
+        copyNetLinks(values, 1);
+    else
+        decodeWeights(agentWeights.block[a], values);
+}
+
+// gives agent a the links in values, in the layout of copyNetLinks
+void setAgentLinks(int a, real *values)
+{
+    if (!WEIGHT_TEMPLATES)
+    {
+        lens("useNet agent%d", a);
+        copyNetLinks(values, 0);
+        return;
+    }
+
+    encodeWeights(values, privateAgentBlock(a));
+
+    if (a == agentWeights.current)
+    {
+        decodeWeights(agentWeights.block[a], agentWeights.values); // as it will be loaded next time
+        copyNetLinks(agentWeights.values, 0);
+        agentWeights.trained = 0;
+    }
+}
+
+// makes agent a the current agent with the links in values in the network, as they are and
+// not rounded to its block, trained or not since it was loaded: how getAgentLinks found it
+void setCurrentAgentLinks(int a, real *values, int trained)
+{
+    useAgentNet(a);
+    copyNetLinks(values, 0);
+    agentWeights.trained = trained;
+}
+
+// PRETRAINED_SNAPSHOTS: copies the block of every agent, in agent order, to blocks
+void copyAgentBlocks(char *blocks)
+{
+    AgentWeights *w = &agentWeights;
+
+    for (int a = 0; a < n_agents; a++)
+        memcpy(blocks + (size_t)a * w->blockBytes, w->block[a], w->blockBytes);
+}
+
+// PRETRAINED_SNAPSHOTS: gives every agent a private block copied from blocks; no agent's
+// weights are in the network afterwards
+void setAgentBlocks(const char *blocks)
+{
+    AgentWeights *w = &agentWeights;
+
+    memcpy(w->blockPool, blocks, (size_t)n_agents * w->blockBytes);
+
+    for (int a = 0; a < n_agents; a++)
+    {
+        w->block[a] = w->blockPool + (size_t)a * w->blockBytes;
+        w->isPrivate[a] = 1;
+    }
+
+    w->nPrivate = n_agents;
+    w->current  = -1;
+    w->trained  = 0;
+}
+
+// gives every network the training set, as pretraining does, when pretraining is skipped
+void attachTrainingSets(void)
+{
+    real inputs[n_features];
+
+    memset(inputs, 0, sizeof(inputs));
+
+    if (WEIGHT_TEMPLATES)
+    {
+        lens("useNet agents");
+        createExampleSet(inputs, inputs);
+        lens("useTrainingSet train");
+        return;
+    }
+
+    for (int ext = 0; ext < n_agents; ext++)
+    {
+        useAgentNet(intId(ext));
+        if (ext == 0)
+            createExampleSet(inputs, inputs);
+        lens("useTrainingSet train");
+    }
+}
+
+     // computes outputs for agent from its inputs
+     // leaves result in array referenced by outs.
+void computeOutputs(int agent, real *ins, real *outs, int tick)
+{
+    useAgentNet(agent);
+
+    if (SAVE_WEIGHTS && (tick == 0))
+        lens("saveWeights weights_tick_%d_agent_%d.wt", tick, extId(agent));
+
+//    printf("about to overwrite example for agent %d\n", agent);
+    overwriteExample(ins, ins);
+//    printf("about to train 1\n");
+    lens("train 1");
+    agentWeights.trained = 1;
+//    printf("train 1 completed\n");
+    saveOutputs(outs);
+}
+
+// LAZY_AGENTS: creates agent a at tick if it does not exist yet
+void requireAgent(int a, int tick)
+{
+    AgentWeights *w = &agentWeights;
+
+    if (!LAZY_AGENTS || w->created[a])
+        return;
+
+    int t = a % w->nTemplates;
+    real inputs[n_features];
+
+    if (!w->templateMade[t])
+    {
+        storeCurrentAgentWeights();
+        lens("seed %u", (unsigned)(w->seed ^ (w->seed >> 32) ^ ((uint64_t)t * 0x9E3779B9U)));
+        lens("resetNet");
+        copyNetLinks(w->values, 1);
+        encodeWeights(w->values, w->templates + t * w->blockBytes);
+        w->templateMade[t] = 1;
+        w->current = -1;
+    }
+
+    GraphRng rng = graphRngStream(w->seed, AGENT_STREAM, (uint64_t)a);
+
+    for (int i = 0; i < n_features; i++)    // as distortAgentPrototype
+        inputs[i] = (graphRngReal(&rng) < item_p_flip) ? (graphRngReal(&rng) < proto_p_on) : prototype[a][i];
+
+    removeAgentMetrics(a);
+    computeOutputs(a, inputs, outputs[a], tick);
+    addAgentMetrics(a);
+
+    writeHistoryRow(tick, extId(a), HISTORY_SENDER_PRETRAINING, inputs, outputs[a]);
+
+    w->created[a] = 1;
+    w->nCreated++;
+}
+
+// LAZY_AGENTS: instead of pretraining, no agent exists when the run starts
+void startLazyAgents(void)
+{
+    attachTrainingSets();
+
+    for (int a = 0; a < n_agents; a++)
+        memset(outputs[a], 0, n_features * sizeof(real));
+}
+
+
+void printOutputs(int i)	// print outputs from agent i
+{
+        if (!DISPLAY_TO_SCREEN) return;
+
+	printf("outputs from agent %d:  ", extId(i));
+
+	for (int outNum = 0; outNum < n_features; outNum++)
+	{
+		printf("%f  ", outputs[i][outNum]);
+	}
+
+	printf("\n");
+}
+
+void printAllOutputs()	// print outputs from all agents
+{
+        if (!DISPLAY_TO_SCREEN) return;
+
+	for (int i = 0; i < n_agents; i++)
+	{
+		printOutputs(intId(i));
+	}
+}
+
+
+// Per-agent state.  outputs, prototype and uber_prototype are rows of n_features reals in one
+// block allocated by allocAgentState at the start of each run, so memory follows n_agents and
+// n_features and there is no limit on either.  Each row is padded to a multiple of
+// AGENT_ROW_ALIGN bytes and starts on such a boundary, so rows do not share cache lines.
+
+static void *agentStateArena;
+static AgentArena agentRowsArena;  // agentStateArena when it is not in the agent state file
+static real **agentStateRows;
+
+void allocAgentState(int runNum)
+{
+    size_t stride = ((size_t)n_features * sizeof(real) + AGENT_ROW_ALIGN - 1) / AGENT_ROW_ALIGN * AGENT_ROW_ALIGN;
+    size_t nRows  = 2 * (size_t)n_agents + 1;
+
+    if (AGENT_STATE_FILE[0] && !WEIGHT_TEMPLATES)
+    {
+        printf("AGENT_STATE_FILE NEEDS WEIGHT_TEMPLATES\n");
+        exit(1);
+    }
+
+    if (AGENT_STATE_FILE[0])
+        agentStateArena = mapAgentStateRows(runNum, nRows * stride, stride); // zero, and page aligned
+    else
+    {
+        agentRowsArena  = mapAgentArena(nRows * stride);
+        agentStateArena = agentRowsArena.base;
+    }
+
+    if (!(agentStateRows = malloc(2 * (size_t)n_agents * sizeof(real *))))
+    {
+        printf("NOT ENOUGH MEMORY FOR %d AGENTS\n", n_agents);
+        exit(1);
+    }
+
+    outputs   = agentStateRows;
+    prototype = agentStateRows + n_agents;
+
+    for (size_t r = 0; r < nRows; r++)
+    {
+        real *row = (real *)((char *)agentStateArena + r * stride);
+
+        if (r == 0)
+            uber_prototype = row;
+        else if (r <= (size_t)n_agents)
+            outputs[r - 1] = row;
+        else
+            prototype[r - 1 - n_agents] = row;
+    }
+}
+
+void freeAgentState(void)
+{
+    if (agentStateFile.fd >= 0)
+        closeAgentStateFile(n_agents);
+    else
+    {
+        reportAgentArena("agent rows", &agentRowsArena);
+        unmapAgentArena(&agentRowsArena);
+    }
+    free(agentStateRows);
+    agentStateArena = NULL;
+    agentStateRows  = NULL;
+    outputs = prototype = NULL;
+    uber_prototype = NULL;
+}
+
+
+void initializeRun(int runNum)
+{
+    int a, i;
+    FILE *fp;
+    char filename[40];
+
+    if (!DISPLAY_TO_SCREEN)
+        lens("verbosity 0");
+
+    allocAgentState(runNum);
+
+    sprintf(filename, "prototypes_%d.txt", runNum);
+    fp = fopen(filename, "w");
+
+    // initialize prototypes
+
+    // create uber (main) prototype (each feature on with prob proto_p_on)
+
+    for (i = 0 ; i < n_features ; i++)
+        uber_prototype[i] = oneWithProb(proto_p_on);
+
+    if (DISPLAY_TO_SCREEN) printf("Uber:    ") ;
+    printVector(uber_prototype, n_features);
+
+    fprintf(fp, "U ");
+    fprintVector(fp, uber_prototype, n_features);
+
+    // create agent-specific prototypes as distortions of uber prototype
+    // (with prob proto_p_flip, regenerate feature (1 with prob proto_p_on))
+    for (a = 0 ; a < n_agents ; a++)
+    {
+        for (i = 0 ; i < n_features ; i++)
+            prototype[a][i] = (oneWithProb(proto_p_flip) ? oneWithProb(proto_p_on) : uber_prototype[i]); 
+
+        if (DISPLAY_TO_SCREEN) printf("Proto %d: ", a);
+        printVector(prototype[a], n_features) ;
+
+        fprintf(fp, "%d ", a);
+        fprintVector(fp, prototype[a], n_features);
+
+    }
+
+    fclose(fp);
+
+    initAgentConnections(runNum); // initiialize graph of agent_networonetwork
+
+    createAgentNets(runNum);
+
+    storeParameters(runNum);
+}
+
+
+void concludeRun(int runNum)
+{
+    deleteAgentNets(); // delete all networks because they will be recreated on next run
+    printf("\nrunNum %d completed\n", runNum);
+    printf("graph cache: %d memory hits, %d disk hits, %d misses so far\n\n", graphCacheMemoryHits, graphCacheDiskHits, graphCacheMisses);
+
+    freeAgentSampling();
+    freeEdgeSampler();
+    freeAgentGraph();
+    freeImplicitRing();
+    freeAgentOrder();
+    freeAgentState();
+}
+
+
+// sets distortedProto to a random distortion of proto
+void distortAgentPrototype(real *proto, real *distortedProto)
+{
+    int i;
+
+    for (i = 0 ; i < n_features ; i++)
+        distortedProto[i] = oneWithProb(item_p_flip) ? oneWithProb(proto_p_on) : proto[i];
+}
+
+
+     // load a network for each agent ans separately pretrain it; keptInputs, if not NULL,
+     // receives the input each agent was pretrained on
+void pretraining(real *keptInputs)
+{
+    int a;  // agent#
+    real inputs[n_features];
+
+    // load and pretrain each agent
+    if (DISPLAY_TO_SCREEN) printf("outputs of PRETRAINING (one epoch):\n");
+
+    for (int ext = 0 ; ext < n_agents ; ext++) // in the original order of the agents (see renumberAgents)
+    {
+        a = intId(ext);
+
+        // distort agent-specific prototype to create input for epoch 0
+        distortAgentPrototype(prototype[a], inputs);
+
+        if (keptInputs)
+            memcpy(keptInputs + (size_t)a * n_features, inputs, sizeof(inputs));
+
+        useAgentNet(a);
+        if (ext == 0)
+        {
+//             printf("about to create example set\n");
+             createExampleSet(inputs, inputs);
+//             printf("created example set\n");
+        }
+        lens("useTrainingSet train") ;
+
+
+        computeOutputs(a, inputs, outputs[a], 0); // loads inputs (as both inputs and targets) 
+        // saves outputs in outputs[a] since it will be the initial output value for
+	// iterations in processRun.
+
+        if (DISPLAY_TO_SCREEN) printf("Agent %d: ", ext) ;
+        printVector(outputs[a], n_features);
+
+	// For tick 0, store initial data for each agent in format:
+	// <tick#> <agent#> - - <inputs> <outputs>
+        writeHistoryRow(0, ext, HISTORY_SENDER_PRETRAINING, inputs, outputs[a]);
+    }
+}
+
+
+int usingSocialForInput(int tick)
+{
+    real p;  // probability of using social communication for input at tick (as opposed to prototype)
+
+    real x = (real)tick / (real)n_ticks;
+
+    if ( strcmp(SOCIAL_PROB_ALGORITHM, "constant") == 0 )
+    {
+        p = social_prob_parameter;  // in this case, the constant is the parameter
+    }
+    else if ( strcmp(SOCIAL_PROB_ALGORITHM, "linear") == 0 )
+    {
+        p = x;
+    }
+    else if ( strcmp(SOCIAL_PROB_ALGORITHM, "logistic_increasing") == 0 )
+    {
+        x -= 0.5;
+        p =  1.0 / (1.0 + exp(-social_prob_parameter * x)); // prob of using social communication
+    }
+    else if ( strcmp(SOCIAL_PROB_ALGORITHM, "logistic_decreasing") == 0 )
+    {
+        x -= 0.5;
+        p =  1.0 - 1.0 / (1.0 + exp(-social_prob_parameter * x)); // prob of using social communication
+    }
+    else
+    {
+        printf("INVALID SOCIAL_PROB_ALGORITHM");
+        exit(1);
+    }
+
+//    printf("prob of using output of sender (social communication) for input at tick %d = %f\n", tick, p);
+//    printf("computed from %s algorithm using parameter %f\n", SOCIAL_PROB_ALGORITHM, social_prob_parameter);
+
+    if (rand_real() < p)
+	return 1;  // use output of sender (social communication)
+    else
+        return 0;  // use distorted prototype
+}
+
+
+// writes out the history written so far; the next row starts a new block
+void syncHistory(void)
+{
+    if (historyFormat == HISTORY_NONE)
+        return;
+
+    if (historyFormat != HISTORY_TEXT && history.used > 0)
+        flushHistory();
+
+    if (history.threaded)
+    {
+        pthread_mutex_lock(&history.lock);
+        while (history.nFull > 0)
+            pthread_cond_wait(&history.changed, &history.lock);
+        pthread_mutex_unlock(&history.lock);
+    }
+
+    fflush(history.fp);
+}
+
+static void writeCheckpointArray(FILE *fp, const void *p, size_t size, size_t n)
+{
+    if (n > 0 && fwrite(p, size, n, fp) != n)
+    {
+        printf("COULD NOT WRITE CHECKPOINT\n");
+        exit(1);
+    }
+}
+
+static void readCheckpointArray(FILE *fp, void *p, size_t size, size_t n)
+{
+    if (n > 0 && fread(p, size, n, fp) != n)
+    {
+        printf("TRUNCATED CHECKPOINT\n");
+        exit(1);
+    }
+}
+
+static int64_t outputOffset(FILE *fp)
+{
+    if (!fp)
+        return 0;
+
+    fflush(fp);
+    return (int64_t)ftello(fp);
+}
+
+// writes header and, unless the run is complete, the state after tick to checkpoint_%d.bin
+static void writeCheckpointFile(int runNum, CheckpointHeader *header)
+{
+    char filename[40], tmpName[40];
+    FILE *fp;
+
+    sprintf(filename, "checkpoint_%d.bin", runNum);
+    sprintf(tmpName, "checkpoint_%d.tmp", runNum);
+
+    if (!(fp = fopen(tmpName, "wb")))
+    {
+        printf("COULD NOT WRITE %s\n", tmpName);
+        exit(1);
+    }
+
+    writeCheckpointArray(fp, header, sizeof(*header), 1);
+
+    if (!header->complete)
+    {
+        real *links = malloc(2 * (size_t)header->nLinks * sizeof(real));
+
+        writeCheckpointArray(fp, uber_prototype, sizeof(real), n_features);
+        for (int a = 0; a < n_agents; a++)
+        {
+            writeCheckpointArray(fp, prototype[a], sizeof(real), n_features);
+            writeCheckpointArray(fp, outputs[a], sizeof(real), n_features);
+        }
+
+        if (LAZY_AGENTS)
+            writeCheckpointArray(fp, agentWeights.created, 1, n_agents);
+
+        for (int a = 0; a < n_agents; a++)
+        {
+            getAgentLinks(a, links);
+            writeCheckpointArray(fp, links, sizeof(real), 2 * (size_t)header->nLinks);
+        }
+        free(links);
+
+        if (header->nEdges > 0)
+        {
+            writeCheckpointArray(fp, agentGraph.edge, sizeof(uint64_t), header->nEdges);
+            writeCheckpointArray(fp, agentGraph.sender, sizeof(uint32_t), header->nEdges);
+            if (agentGraph.weight)
+                writeCheckpointArray(fp, agentGraph.weight, sizeof(float), header->nEdges);
+            if (weightMode == DYNAMIC_WEIGHTS)
+                writeCheckpointArray(fp, edgeSampler.tree, sizeof(double), (size_t)header->nEdges + 1);
+        }
+
+        if (samplingMode == SENDER_FIRST) // each agent's receivers, in the order sampling uses
+            for (int a = 0; a < n_agents; a++)
+            {
+                writeCheckpointArray(fp, &senderIndex.degree[a], sizeof(uint32_t), 1);
+                writeCheckpointArray(fp, senderIndex.pool + senderIndex.start[a], sizeof(uint32_t), senderIndex.degree[a]);
+            }
+
+        if (samplingMode != EDGE_UNIFORM)
+            writeCheckpointArray(fp, firstAgents.agent, sizeof(uint32_t), firstAgents.n);
+
+        if (historyFormat == HISTORY_COMPRESSED)
+            writeCheckpointArray(fp, history.index, sizeof(HistoryIndexEntry), history.nBlocks);
+
+        if (metrics.fp)
+        {
+            writeCheckpointArray(fp, metrics.sum, sizeof(double), n_features);
+            writeCheckpointArray(fp, metrics.ones, sizeof(int), n_features);
+        }
+    }
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 || rename(tmpName, filename) != 0)
+    {
+        printf("COULD NOT WRITE %s\n", filename);
+        exit(1);
+    }
+}
+
+static void initCheckpointHeader(CheckpointHeader *header, int runNum, int tick)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->headerSize = sizeof(*header);
+    header->runNum     = runNum;
+    header->tick       = tick;
+    header->nAgents    = n_agents;
+    header->nFeatures  = n_features;
+    header->nHidden    = n_hidden;
+    header->nEdges     = agentGraph.edge ? agentGraph.nEdges : 0;
+    memcpy(header->randStart, runRandStart, sizeof(header->randStart));
+    getRandState(header->randState);
+}
+
+// the state after tick
+void writeCheckpoint(int runNum, int tick)
+{
+    CheckpointHeader header;
+    double start = wallSeconds();
+
+    syncHistory();
+    initCheckpointHeader(&header, runNum, tick);
+
+    header.nLinks            = agentNetLinks();
+    header.nFirstAgents      = firstAgents.n;
+    header.currentAgent      = WEIGHT_TEMPLATES ? agentWeights.current : -1;
+    header.currentTrained    = agentWeights.trained;
+    header.rewireRng         = rewireRng.state;
+    header.historyOffset     = outputOffset(history.fp);
+    header.rewireOffset      = outputOffset(rewireFile);
+    header.metricsOffset     = outputOffset(metrics.fp);
+    header.historyRows       = history.nRows;
+    header.historyRecords    = history.nRecords;
+    header.historyBlocks     = history.nBlocks;
+    header.rewireEvents      = nRewireEvents;
+    header.edgeWeightTotal   = edgeSampler.total;
+    header.metricsSumSquares = metrics.sumSquares;
+
+    writeCheckpointFile(runNum, &header);
+    printf("checkpoint at tick %d written in %.3f seconds\n", tick, wallSeconds() - start);
+}
+
+// replaces the checkpoint of a finished run by its random state
+void writeCompletedCheckpoint(int runNum)
+{
+    CheckpointHeader header;
+
+    initCheckpointHeader(&header, runNum, n_ticks);
+    header.complete = 1;
+    writeCheckpointFile(runNum, &header);
+}
+
+// -restart: reads the header of the run's checkpoint into resumeFrom; returns whether there is one
+int findCheckpoint(int runNum)
+{
+    char filename[40];
+    FILE *fp;
+
+    sprintf(filename, "checkpoint_%d.bin", runNum);
+
+    if (!(fp = fopen(filename, "rb")))
+        return 0;
+
+    if (fread(&resumeFrom, sizeof(resumeFrom), 1, fp) != 1 ||
+        memcmp(resumeFrom.magic, CHECKPOINT_MAGIC, sizeof(resumeFrom.magic)) != 0 ||
+        resumeFrom.headerSize != sizeof(resumeFrom) || resumeFrom.runNum != runNum)
+    {
+        printf("%s IS NOT A CHECKPOINT OF THIS PROGRAM\n", filename);
+        exit(1);
+    }
+
+    if (SEED < 0)
+    {
+        printf("RESTART REQUIRES SEED >= 0\n");
+        exit(1);
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+// Puts back the state of the checkpoint in resumeFrom, once the run has been set up again
+// and its output files reopened; used instead of pretraining.
+void restoreCheckpoint(int runNum)
+{
+    char filename[40];
+    FILE *fp;
+    CheckpointHeader header;
+
+    sprintf(filename, "checkpoint_%d.bin", runNum);
+
+    if (!(fp = fopen(filename, "rb")))
+    {
+        printf("COULD NOT OPEN %s\n", filename);
+        exit(1);
+    }
+
+    readCheckpointArray(fp, &header, sizeof(header), 1);
+
+    if (header.nAgents != n_agents || header.nFeatures != n_features || header.nHidden != n_hidden ||
+        header.nEdges != (agentGraph.edge ? agentGraph.nEdges : 0) || header.nLinks != agentNetLinks())
+    {
+        printf("CHECKPOINT %s DOES NOT MATCH THE PARAMETERS OF RUN %d\n", filename, runNum);
+        exit(1);
+    }
+
+    readCheckpointArray(fp, uber_prototype, sizeof(real), n_features);
+    for (int a = 0; a < n_agents; a++)
+    {
+        readCheckpointArray(fp, prototype[a], sizeof(real), n_features);
+        readCheckpointArray(fp, outputs[a], sizeof(real), n_features);
+    }
+
+    if (LAZY_AGENTS)
+    {
+        readCheckpointArray(fp, agentWeights.created, 1, n_agents);
+        for (int a = 0; a < n_agents; a++)
+            agentWeights.nCreated += agentWeights.created[a];
+    }
+
+    // the networks
+    real *links = malloc(2 * (size_t)header.nLinks * sizeof(real));
+    real *currentLinks = malloc(2 * (size_t)header.nLinks * sizeof(real));
+
+    attachTrainingSets();
+
+    for (int a = 0; a < n_agents; a++)
+    {
+        readCheckpointArray(fp, links, sizeof(real), 2 * (size_t)header.nLinks);
+        if (!LAZY_AGENTS || agentWeights.created[a])  // the others still start from their template
+            setAgentLinks(a, links);
+        if (a == header.currentAgent)
+            memcpy(currentLinks, links, 2 * (size_t)header.nLinks * sizeof(real));
+    }
+
+    if (header.currentAgent >= 0)  // its weights in the network may not be those of its block
+        setCurrentAgentLinks(header.currentAgent, currentLinks, header.currentTrained);
+    free(links);
+    free(currentLinks);
+
+    // the graph as rewired, its weights, and the sampling state that depends on them
+    if (header.nEdges > 0)
+    {
+        readCheckpointArray(fp, agentGraph.edge, sizeof(uint64_t), header.nEdges);
+        readCheckpointArray(fp, agentGraph.sender, sizeof(uint32_t), header.nEdges);
+        if (agentGraph.weight)
+            readCheckpointArray(fp, agentGraph.weight, sizeof(float), header.nEdges);
+        if (weightMode == DYNAMIC_WEIGHTS)
+        {
+            readCheckpointArray(fp, edgeSampler.tree, sizeof(double), (size_t)header.nEdges + 1);
+            edgeSampler.total = header.edgeWeightTotal;
+        }
+    }
+
+    if (samplingMode == SENDER_FIRST)
+    {
+        uint32_t slot = 0;
+
+        for (int a = 0; a < n_agents; a++)
+        {
+            uint32_t degree;
+
+            readCheckpointArray(fp, &degree, sizeof(uint32_t), 1);
+
+            if (slot + degree > senderIndex.poolCapacity)
+            {
+                senderIndex.poolCapacity = 2 * ((size_t)slot + degree);
+                senderIndex.pool = realloc(senderIndex.pool, senderIndex.poolCapacity * sizeof(uint32_t));
+            }
+
+            readCheckpointArray(fp, senderIndex.pool + slot, sizeof(uint32_t), degree);
+            senderIndex.start[a] = slot;
+            senderIndex.degree[a] = senderIndex.capacity[a] = degree;
+            slot += degree;
+        }
+        senderIndex.poolSize = slot;
+    }
+
+    if (samplingMode != EDGE_UNIFORM)
+    {
+        firstAgents.n = header.nFirstAgents;
+        readCheckpointArray(fp, firstAgents.agent, sizeof(uint32_t), firstAgents.n);
+
+        for (int a = 0; a < n_agents; a++)
+            firstAgents.position[a] = UINT32_MAX;
+        for (int i = 0; i < firstAgents.n; i++)
+            firstAgents.position[firstAgents.agent[i]] = i;
+    }
+
+    if (historyFormat == HISTORY_COMPRESSED && header.historyBlocks > 0)
+    {
+        size_t capacity = 1; // as writeHistoryBlock grows it
+
+        while (capacity < header.historyBlocks)
+            capacity *= 2;
+
+        history.index = malloc(capacity * sizeof(HistoryIndexEntry));
+        history.nBlocks = header.historyBlocks;
+        readCheckpointArray(fp, history.index, sizeof(HistoryIndexEntry), history.nBlocks);
+    }
+
+    initMetrics(runNum);
+
+    if (metrics.fp)
+    {
+        readCheckpointArray(fp, metrics.sum, sizeof(double), n_features);
+        readCheckpointArray(fp, metrics.ones, sizeof(int), n_features);
+        metrics.sumSquares = header.metricsSumSquares;
+
+        for (int a = 0; a < n_agents; a++)
+            setAgentPattern(a);
+        rebuildPatternTable();
+    }
+
+    fclose(fp);
+    seed48(header.randState);
+    printf("run %d resumed from the checkpoint at tick %d\n", runNum, header.tick);
+}
+
+// Tick schedule.  The receiver and sender of tick t are drawn by chooseRandomConnection with
+// drand48 seeded from SEED, the run number and t, and drand48 is then put back as it was, so
+// a pair does not depend on when it is drawn nor on the random numbers of other ticks.  With
+// SCHEDULE_LOOKAHEAD L > 0 the pair of each tick is drawn L ticks before the tick is run, so
+// that what it needs can be fetched ahead (see the agent state file); the run is the same as
+// with L = 0.  Drawing ahead needs a graph and weights that do not change during the run: no
+// rewiring and no DYNAMIC_WEIGHTS.
+
+typedef struct ScheduledTick
+{
+    int32_t receiver;
+    int32_t sender;
+    int32_t ac;               // edge id, see chooseRandomConnection
+} ScheduledTick;
+
+typedef struct Schedule
+{
+    ScheduledTick *ticks;     // ring of L + 1, tick t at t % (L + 1)
+    uint32_t      *pending;   // of each agent: drawn ticks not run yet that need it
+    int            nextTick;  // first tick not drawn
+    uint64_t       seed;
+} Schedule;
+
+Schedule schedule;
+
+void startSchedule(int runNum, int firstTick)
+{
+    schedule.seed = graphSeed(runNum) ^ 0x5CE0D11E5CE0D11EULL;
+
+    if (!SCHEDULE_LOOKAHEAD)
+        return;
+
+    if (REWIRE_RATE > 0.0 || weightMode == DYNAMIC_WEIGHTS)
+    {
+        printf("SCHEDULE_LOOKAHEAD NEEDS A GRAPH THAT DOES NOT CHANGE DURING THE RUN\n");
+        exit(1);
+    }
+
+    schedule.ticks    = malloc((SCHEDULE_LOOKAHEAD + 1) * sizeof(ScheduledTick));
+    schedule.pending  = calloc(n_agents, sizeof(uint32_t));
+    schedule.nextTick = firstTick;
+
+    if (!schedule.ticks || !schedule.pending)
+    {
+        printf("NOT ENOUGH MEMORY FOR THE SCHEDULE\n");
+        exit(1);
+    }
+}
+
+void freeSchedule(void)
+{
+    free(schedule.ticks);
+    free(schedule.pending);
+    memset(&schedule, 0, sizeof(schedule));
+}
+
+static ScheduledTick drawScheduledTick(int tick)
+{
+    uint64_t state = schedule.seed ^ ((uint64_t)tick * 0xD1B54A32D192ED03ULL);
+    uint64_t x = splitmix64(&state);
+    unsigned short seed[3] = { (unsigned short)x, (unsigned short)(x >> 16), (unsigned short)(x >> 32) };
+    unsigned short saved[3];
+    ScheduledTick s;
+    int receiver, sender;
+
+    getRandState(saved);
+    seed48(seed);
+    s.ac = chooseRandomConnection(&receiver, &sender);
+    seed48(saved);
+
+    s.receiver = receiver;
+    s.sender   = sender;
+    return s;
+}
+
+// the receiver and sender of tick, drawn ahead with SCHEDULE_LOOKAHEAD and otherwise now;
+// returns the edge id as chooseRandomConnection does
+int scheduledConnection(int tick, int *pReceiver, int *pSender)
+{
+    if (!SCHEDULE_LOOKAHEAD)
+    {
+        ScheduledTick s = drawScheduledTick(tick);
+
+        *pReceiver = s.receiver;
+        *pSender   = s.sender;
+        return s.ac;
+    }
+
+    for (; schedule.nextTick <= tick + SCHEDULE_LOOKAHEAD && schedule.nextTick <= n_ticks; schedule.nextTick++)
+    {
+        ScheduledTick *s = &schedule.ticks[schedule.nextTick % (SCHEDULE_LOOKAHEAD + 1)];
+
+        *s = drawScheduledTick(schedule.nextTick);
+        schedule.pending[s->receiver]++;
+        agentStateWillBeNeeded(s->receiver, s->sender);
+    }
+
+    ScheduledTick *s = &schedule.ticks[tick % (SCHEDULE_LOOKAHEAD + 1)];
+
+    *pReceiver = s->receiver;
+    *pSender   = s->sender;
+    return s->ac;
+}
+
+// after tick has been run: the receiver's block can go if no drawn tick needs it.  Its trained
+// weights are stored into the block first, as useAgentNet would do at the next tick, touching
+// the block right after it was advised cold.
+void tickDone(int receiver)
+{
+    if (!SCHEDULE_LOOKAHEAD)
+        return;
+
+    if (--schedule.pending[receiver] == 0)
+    {
+        if (receiver == agentWeights.current)
+            storeCurrentAgentWeights();
+
+        agentStateNotNeeded(receiver);
+    }
+}
+
+// Pretrained snapshots.  With PRETRAINED_SNAPSHOTS, the state after pretraining (the
+// outputs, the agents' weight blocks, the pretraining inputs for the history, and the
+// drand48 state) is kept in memory for each run number, and a later parameter combination
+// whose runs are set up and pretrained the same way starts its tick loop from that state
+// instead of pretraining again.  The tick loops then differ only in the parameters that
+// pretraining does not use, such as social_prob_parameter; item_p_flip is part of the setup,
+// since pretraining trains on distortions of the prototypes.
+//
+// The snapshots need WEIGHT_TEMPLATES: the agents then share one Lens network, so what is
+// per agent in the setup is only the weight block, and a fork copies the blocks of the
+// snapshot instead of making the templates and pretraining.  What remains of the setup of a
+// forked run is the prototypes and the graph (usually from the graph cache).  The network
+// of the agent that was last pretrained is kept as it was, since it has not been rounded to
+// its block yet (see weightStorage).
+//
+// For the runs of different combinations to be set up the same way, drand48 and the random
+// number generator of Lens are seeded at the start of each run from SEED and the run number,
+// instead of going on from the previous run, so the random numbers of a sweep are not those
+// drawn without PRETRAINED_SNAPSHOTS.  With the outer loops of processAllParamCombos over
+// the setup parameters, combinations sharing a setup follow each other, so one snapshot per
+// run number is kept, replaced when the setup changes.
+
+typedef struct PretrainedSnapshot
+{
+    int      valid;
+    int      nAgents;        // the setup it was made with
+    int      nFeatures;
+    int      nHidden;
+    real     protoPOn;
+    real     protoPFlip;
+    real     itemPFlip;
+    uint32_t nLinks;
+    real    *inputs;         // pretraining input of each agent
+    real    *outputs;        // of each agent after pretraining
+    char    *blocks;         // of each agent, see copyAgentBlocks
+    int      currentAgent;   // agent whose weights were in the network
+    int      currentTrained;
+    real    *currentLinks;   // and those weights, see getAgentLinks
+    unsigned short randState[3]; // drand48 state after pretraining
+} PretrainedSnapshot;
+
+PretrainedSnapshot pretrainedSnapshots[N_RUNS];
+
+// PRETRAINED_SNAPSHOTS: random state of the start of a run, from SEED and the run number
+void seedRun(int runNum)
+{
+    uint64_t state = graphSeed(runNum) ^ 0xD1B54A32D192ED03ULL;
+    uint64_t x = splitmix64(&state);
+    unsigned short seed[3] = { (unsigned short)x, (unsigned short)(x >> 16), (unsigned short)(x >> 32) };
+
+    seed48(seed);
+    lens("seed %u", (unsigned)(x >> 48)); // and the initial weights of the networks
+}
+
+static int snapshotMatches(const PretrainedSnapshot *snapshot)
+{
+    return snapshot->valid && snapshot->nAgents == n_agents && snapshot->nFeatures == n_features &&
+           snapshot->nHidden == n_hidden && snapshot->protoPOn == proto_p_on &&
+           snapshot->protoPFlip == proto_p_flip && snapshot->itemPFlip == item_p_flip;
+}
+
+// whether run runNum will start from a snapshot
+int forksPretrainedSnapshot(int runNum)
+{
+    return PRETRAINED_SNAPSHOTS && snapshotMatches(&pretrainedSnapshots[runNum]);
+}
+
+// Pretrains the agents of run runNum, or, if a snapshot of the same setup was kept, puts its
+// state back and writes the rows of tick 0 of the history as pretraining would.
+void pretrainOrFork(int runNum)
+{
+    if (!PRETRAINED_SNAPSHOTS)
+    {
+        pretraining(NULL);
+        return;
+    }
+
+    PretrainedSnapshot *snapshot = &pretrainedSnapshots[runNum];
+    size_t nValues = (size_t)n_agents * n_features;
+
+    if (forksPretrainedSnapshot(runNum))
+    {
+        attachTrainingSets();
+        setAgentBlocks(snapshot->blocks);
+        if (snapshot->currentAgent >= 0)
+            setCurrentAgentLinks(snapshot->currentAgent, snapshot->currentLinks, snapshot->currentTrained);
+
+        for (int a = 0; a < n_agents; a++)
+            memcpy(outputs[a], snapshot->outputs + (size_t)a * n_features, n_features * sizeof(real));
+
+        for (int ext = 0; ext < n_agents; ext++)
+        {
+            int a = intId(ext);
+            writeHistoryRow(0, ext, HISTORY_SENDER_PRETRAINING, snapshot->inputs + (size_t)a * n_features, outputs[a]);
+        }
+
+        seed48(snapshot->randState);
+        printf("\nrunNum %d starts from the pretrained snapshot\n", runNum);
+        return;
+    }
+
+    free(snapshot->inputs);
+    free(snapshot->outputs);
+    free(snapshot->blocks);
+    free(snapshot->currentLinks);
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    snapshot->inputs = malloc(nValues * sizeof(real));
+    pretraining(snapshot->inputs);
+
+    snapshot->nLinks       = agentNetLinks();
+    snapshot->outputs      = malloc(nValues * sizeof(real));
+    snapshot->blocks       = malloc((size_t)n_agents * agentWeights.blockBytes);
+    snapshot->currentLinks = malloc(2 * (size_t)snapshot->nLinks * sizeof(real));
+
+    if (!snapshot->inputs || !snapshot->outputs || !snapshot->blocks || !snapshot->currentLinks)
+    {
+        printf("NOT ENOUGH MEMORY FOR THE PRETRAINED SNAPSHOT\n");
+        exit(1);
+    }
+
+    copyAgentBlocks(snapshot->blocks);
+    snapshot->currentAgent   = agentWeights.current;
+    snapshot->currentTrained = agentWeights.trained;
+    if (snapshot->currentAgent >= 0)
+        getAgentLinks(snapshot->currentAgent, snapshot->currentLinks);
+
+    for (int a = 0; a < n_agents; a++)
+        memcpy(snapshot->outputs + (size_t)a * n_features, outputs[a], n_features * sizeof(real));
+
+    snapshot->nAgents    = n_agents;
+    snapshot->nFeatures  = n_features;
+    snapshot->nHidden    = n_hidden;
+    snapshot->protoPOn   = proto_p_on;
+    snapshot->protoPFlip = proto_p_flip;
+    snapshot->itemPFlip  = item_p_flip;
+    getRandState(snapshot->randState);
+    snapshot->valid = 1;
+}
+
+void processRun(int runNum)
+{
+    int tick;	// tick #
+    int firstTick = 1;
+
+    resuming = restartFromCheckpoints && findCheckpoint(runNum);
+
+    if (resuming && resumeFrom.complete)
+    {
+        seed48(resumeFrom.randState); // as if the run had been made again
+        printf("\nrunNum %d was completed before the restart\n", runNum);
+        resuming = 0;
+        return;
+    }
+
+    if (resuming)
+        seed48(resumeFrom.randStart); // so that the run is set up as it was
+    else if (PRETRAINED_SNAPSHOTS)
+        seedRun(runNum);
+
+    getRandState(runRandStart);
+    initializeRun(runNum);
+    openHistory(runNum);
+    initRewiring(runNum);
+
+    double start = wallSeconds();
+
+    if (resuming)
+    {
+        restoreCheckpoint(runNum);
+        firstTick = resumeFrom.tick + 1;
+    }
+    else
+    {
+        if (LAZY_AGENTS)
+            startLazyAgents();
+        else
+            pretrainOrFork(runNum);
+        printAllOutputs();	// starting outputs
+        initMetrics(runNum);
+    }
+
+  // for some number of iterations, select FROM and TO randomly, then
+  // train TO on last output of FROM (saved in outputs[FROM])
+
+        if (DISPLAY_TO_SCREEN) printf("\nCOMMUNICATION or distorted prototype:\n");
+
+	startSchedule(runNum, firstTick);
+
+	for (tick = firstTick; tick <= n_ticks; tick++)
+	{
+		int receiver, sender;  // agent # of receiving agent and sending agent
+                int useProto;
+		real inputsReceiver[n_features];
+
+		int ac = scheduledConnection(tick, &receiver, &sender);
+		// agent receiver's input gets agent sender's output
+		// we assume here that the number of inputs and outputs are both = n_features.  Otherwise a transformation
+		// function would have to be applied to the output.
+
+                if (DISPLAY_TO_SCREEN) printf("\nat tick %d:\n", tick);
+
+                useProto = !usingSocialForInput(tick);
+
+                if (sender < 0) // a receiver without senders (ZERO_DEGREE_USE_PROTOTYPE)
+                    useProto = 1;
+
+                requireAgent(receiver, tick);
+                if (!useProto)
+                    requireAgent(sender, tick);
+
+                if (useProto)
+	        {
+                    if (DISPLAY_TO_SCREEN) printf("agent %d uses distortion of its prototype for input\n", extId(receiver));
+
+                    // distort agent-specific prototype to create input for receiver
+                    distortAgentPrototype(prototype[receiver], inputsReceiver);
+                }
+                else
+                {
+                    if (DISPLAY_TO_SCREEN) printf("agent %d receives output of agent %d\n", extId(receiver), extId(sender));
+
+	    	    for (int i = 0;  i < n_features; i++)
+		        inputsReceiver[i] = outputs[sender][i];
+
+                    if (weightMode == DYNAMIC_WEIGHTS)
+                        addToEdgeWeight(ac, WEIGHT_REINFORCEMENT); // the tie that was used gets stronger
+                }
+
+                if (DISPLAY_TO_SCREEN) printf("useProto = %d\n", useProto);
+
+		removeAgentMetrics(receiver);
+		computeOutputs(receiver, inputsReceiver, outputs[receiver], tick);
+		addAgentMetrics(receiver);
+		writeMetrics(tick);
+		printAllOutputs();
+
+		// For tick, store initial data for each agent in format:
+		// <tick#> <agent#> <1 if receiving agent>  <sending agent#> <inputs> <outputs>
+
+		History_rows rows = historyRowsAtTick(tick, receiver, useProto ? -1 : sender);
+
+		if (rows == RECEIVER_ROW)
+		    writeHistoryRow(tick, extId(receiver), useProto ? HISTORY_SENDER_PROTOTYPE : extId(sender), inputsReceiver, outputs[receiver]);
+
+		for (int ext = 0; ext < n_agents && rows == ALL_ROWS; ext++) // agent number
+		{
+                    int a = intId(ext);
+
+		    if (a != receiver)
+		        writeHistoryRow(tick, ext, HISTORY_SENDER_NONE, NULL, outputs[a]);
+		    else
+		        writeHistoryRow(tick, ext, useProto ? HISTORY_SENDER_PROTOTYPE : extId(sender), inputsReceiver, outputs[a]);
+		}
+
+		rewireConnections(tick);
+
+		tickDone(receiver);
+
+		if (CHECKPOINT_EVERY_K_TICKS > 0 && tick % CHECKPOINT_EVERY_K_TICKS == 0 && tick < n_ticks)
+		    writeCheckpoint(runNum, tick);
+	}
+
+	freeSchedule();
+
+	printf("pretraining and %d ticks took %.3f seconds\n", n_ticks, wallSeconds() - start);
+
+	concludeRewiring();
+	concludeMetrics();
+	closeHistory();
+
+	if (CHECKPOINT_EVERY_K_TICKS > 0 || resuming)
+	    writeCompletedCheckpoint(runNum);
+
+	resuming = 0;
+	concludeRun(runNum);
+}
+
+void processAllParamCombos(void)
+{
+    int runNum;
+    char dirstr[1000] = ""; // name of subdirectory for output data of this parameter combination
+    char cmd[1024] = "";
+
+    int v_n_agents[] = { 100, 1000, 2000 }; // vector of values for n_agents
+    int l_n_agents = sizeof(v_n_agents)/sizeof(v_n_agents[0]); // length of v_n_agents
+    int i_n_agents;             // index into v_n_agents to identify value being used
+
+    int v_n_features[] = { 20, 40 };
+    int l_n_features = sizeof(v_n_features)/sizeof(v_n_features[0]);
+    int i_n_features;  // index into v_n_features
+
+    real v_proportion_hidden[] = { 0.3, 0.5 };
+    int  l_proportion_hidden = sizeof(v_proportion_hidden)/sizeof(v_proportion_hidden[0]);
+    int  i_proportion_hidden;
+
+    real v_proto_p_on[] = { 0.5 };
+    int  l_proto_p_on = sizeof(v_proto_p_on)/sizeof(v_proto_p_on[0]);
+    int  i_proto_p_on;
+
+    real v_proto_p_flip[] = { 0.2 };
+    int  l_proto_p_flip = sizeof(v_proto_p_flip)/sizeof(v_proto_p_flip[0]);
+    int  i_proto_p_flip;
+
+    real v_item_p_flip[] = { 0.1 };
+    int  l_item_p_flip = sizeof(v_item_p_flip)/sizeof(v_item_p_flip[0]);
+    int  i_item_p_flip;
+
+    real v_social_prob_parameter[] = { 0.2 };
+    int  l_social_prob_parameter = sizeof(v_social_prob_parameter)/sizeof(v_social_prob_parameter[0]);
+    int  i_social_prob_parameter;
+
+
+    for (i_n_agents = 0; i_n_agents < l_n_agents; i_n_agents++)
+    {
+      n_agents = v_n_agents[i_n_agents];
+      n_ticks  = 100 * n_agents;
+
+      for (i_n_features = 0; i_n_features < l_n_features; i_n_features++)
+      {
+        n_features = v_n_features[i_n_features];
+
+        for (i_proportion_hidden = 0; i_proportion_hidden < l_proportion_hidden; i_proportion_hidden++)
+        {
+          proportion_hidden = v_proportion_hidden[i_proportion_hidden];
+          n_hidden = (int)round(proportion_hidden * (real)n_features);
+
+          for (i_proto_p_on = 0; i_proto_p_on < l_proto_p_on; i_proto_p_on++)
+          {
+            proto_p_on = v_proto_p_on[i_proto_p_on];
+
+            for (i_proto_p_flip = 0; i_proto_p_flip < l_proto_p_flip; i_proto_p_flip++)
+            {
+              proto_p_flip = v_proto_p_flip[i_proto_p_flip];
+
+              for (i_item_p_flip = 0; i_item_p_flip < l_item_p_flip; i_item_p_flip++)
+              {
+                item_p_flip = v_item_p_flip[i_item_p_flip];
+
+                for (i_social_prob_parameter = 0; i_social_prob_parameter < l_social_prob_parameter; i_social_prob_parameter++)
+                {
+                  social_prob_parameter = v_social_prob_parameter[i_social_prob_parameter];
+
+                  strcpy(dirstr, "");
+
+                  if (l_n_agents > 1)
+                    sprintf(dirstr+strlen(dirstr), "agents%d_", n_agents);
+
+                  if (l_n_features > 1)
+                    sprintf(dirstr+strlen(dirstr), "features%d_", n_features);
+
+                  if (l_proportion_hidden > 1)
+                    sprintf(dirstr+strlen(dirstr), "phidden%.3f_", proportion_hidden);
+
+                  if (l_proto_p_on > 1)
+                    sprintf(dirstr+strlen(dirstr), "protopOn%.3f_", proto_p_on);
+
+                  if (l_proto_p_flip > 1)
+                    sprintf(dirstr+strlen(dirstr), "protopFlip%.3f_", proto_p_flip);
+
+                  if (l_item_p_flip > 1)
+                    sprintf(dirstr+strlen(dirstr), "itempFlip%.3f_", item_p_flip);
+
+                  if (l_social_prob_parameter > 1)
+                    sprintf(dirstr+strlen(dirstr), "socialpParam%.3f_", social_prob_parameter);
+
+                  if (strlen(dirstr) > 0)  // more than one parameter combination is being run
+                  {
+                    dirstr[strlen(dirstr)-1] = '\0'; // remove the final underscore
+                    strcpy(cmd, "mkdir ");
+                    strcat(cmd, dirstr);
+                    system(cmd);  // create subdirectory for data of this parameter combination
+//                    strcpy(cmd, "cd ");
+//                    strcat(cmd, dirstr);
+//                    system(cmd);  // send file output to this subdirectory
+                    int res = chdir(dirstr);
+                    printf("chdir returns %d\n", res);
+                    printf("For data output, getcwd=%s\n\n", getcwd(NULL,0));
+                  }
+
+    if (SEED < 0)
+        srand48(time(NULL));   // seed random number generator
+    else
+    {
+        srand48(SEED);
+    }
+
+                  for (runNum = 0; runNum < N_RUNS; runNum++)
+                  {
+                    processRun(runNum);  // includes addNet and resetNet before the run and deleteNets * afterward.
+                  }
+
+                  if (strlen(dirstr) > 0)
+                  {
+                    int res = chdir("..");  // return to program directory
+                    printf("chdir returns %d\n", res);
+                    printf("Back to program directory: getcwd=%s\n\n", getcwd(NULL,0));
+                  }
+
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    clock_t timer;
+
+    timer = clock();
+
+    restartFromCheckpoints = (argc > 1 && strcmp(argv[1], "-restart") == 0);
+
+//  srand((unsigned) time(NULL)); // seed random number generator
+    if (!restartFromCheckpoints)
+        system("rm *.txt"); // remove output files from previous runs in this directory
+
+    if (startLens(argv[0], 1))
+    {
+        fprintf(stderr, "Lens Failed\n");
+        exit(1);
+    }
+
+    initGraphCache();
+    processAllParamCombos();
+
+    timer = clock() - timer;
+    double seconds = ((double)timer)/CLOCKS_PER_SEC;
+    printf("program took %.3f seconds\n", seconds);    
+}
+